@@ -0,0 +1,48 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <iostream>
+#include <cstring>
+
+#ifdef NODEDUPE
+#define BENCH_MODE "NoDedupe"
+#elif defined(CAFTL)
+#define BENCH_MODE "CAFTL"
+#else
+#define BENCH_MODE "FastCDC"
+#endif
+
+// every result is printed as one json object per line so that runs of different builds can be diffed/plotted
+#define BENCH_RESULT(name, fields) std::cout << "{\"bench\":\"" << name << "\",\"mode\":\"" BENCH_MODE "\"," << fields << "}" << std::endl
+
+inline double bench_now(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void bench_fill_random(char *buf, size_t len, uint64_t seed){
+    std::mt19937_64 rng(seed);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)){
+        uint64_t r = rng();
+        memcpy(buf + i, &r, sizeof(uint64_t));
+    }
+    for (uint64_t r = rng(); i < len; i++, r >>= 8) buf[i] = (char)r;
+}
+
+// log-like text: random words from a small vocabulary, compresses about 3x
+inline void bench_fill_text(char *buf, size_t len, uint64_t seed){
+    static const char *words[] = {"read", "write", "chunk", "group", "inode", "error", "ok", "request", "offset", "size",
+                                  "backend", "dedup", "[info]", "[warn]", "12", "345", "6789", "=", "\n", " "};
+    std::mt19937_64 rng(seed);
+    size_t i = 0;
+    while (i < len){
+        const char *word = words[rng() % (sizeof(words) / sizeof(words[0]))];
+        for (; *word && i < len; word++) buf[i++] = *word;
+        if (i < len) buf[i++] = ' ';
+    }
+}
+
+#endif /* BENCH_H */
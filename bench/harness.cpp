@@ -0,0 +1,393 @@
+// in-process harness: drive cdcfs_write/cdcfs_read/cdcfs_release directly, no FUSE mount needed
+#include <filesystem>
+#include <unistd.h>
+#include <deque>
+#include <atomic>
+#include "../src/file.h"
+#include "bench.h"
+
+#define HARNESS_SEGMENT_SIZE 65536
+
+struct harness_config{
+    int file_num = 16;                      // how many files to write
+    size_t file_size = 64 * 1024 * 1024;    // logical size of each file
+    double dup_ratio = 0.5;                 // fraction of segments copied from earlier data
+    size_t chunk_shift = 0;                 // bytes inserted in front of every duplicated segment
+    size_t write_size = 131072;             // size of every cdcfs_write call (FUSE max_write)
+    size_t read_size = 131072;              // size of every cdcfs_read call
+    bool verify = true;                     // compare read back data with written data
+    const char *chunker = DEFAULT_CHUNKER;  // chunking engine, same as "-o chunker="
+    uint32_t chunk_min = 0, chunk_avg = BLOCK_SIZE, chunk_max = MAX_GROUP_SIZE;
+    const char *compress = "none";          // same as "-o compress="
+    double text_ratio = 0;                  // fraction of fresh segments filled with compressible text
+    int edits = 0;                          // random bytes changed in every duplicated segment (near-duplicates)
+    unsigned delta_depth = 0;               // same as "-o delta_depth="
+    double zero_ratio = 0;                  // fraction of fresh segments that are all zero (sparse images)
+    bool sparse_write = false;              // skip writing all-zero write calls, leaving gaps like a sparse file
+    const char *index = "memory";           // same as "-o index="
+    uint32_t index_cache = INDEX_DEFAULT_CACHE;     // same as "-o index_cache="
+    uint32_t index_sample = INDEX_DEFAULT_SAMPLE;    // same as "-o index_sample="
+    uint32_t index_champions = INDEX_DEFAULT_CHAMPIONS; // same as "-o index_champions="
+    uint32_t write_buffer = DEFAULT_WRITE_BUFFER_SIZE;  // same as "-o write_buffer="
+    unsigned chunk_threads = 1;                         // same as "-o chunk_threads="
+    const char *storage = "file";                       // same as "-o storage="
+    uint32_t zone_size = ZONE_DEFAULT_SIZE;             // same as "-o zone_size="
+    uint32_t zone_num = ZONE_DEFAULT_NUM;               // same as "-o zone_num="
+    uint32_t devices = 1;                               // zones striped over ZONE_PATH/dev_<n> directories
+    int keep = 0;                                       // unlink older files so only the last keep files stay, 0: keep all
+    bool journal = false;                               // same as "-o journal"
+    uint32_t journal_size = JOURNAL_DEFAULT_SIZE;       // same as "-o journal_size="
+    int fsync_every = 0;                                // cdcfs_fsync after every n writes and before release, 0: never
+    int writers = 1;                                    // files written at the same time by their own thread
+    bool recover = false;                               // replay the journal of the last run and verify its files instead of writing
+    bool clone = false;                                 // clone every file with copy_file_range + CDCFS_IOC_CLONE
+    uint32_t rewrite_cap = 0;                           // same as "-o rewrite_cap="
+    uint32_t rewrite_limit = REWRITE_DEFAULT_LIMIT;     // same as "-o rewrite_limit="
+};
+
+static void usage(const char *prog){
+    std::cerr << "usage: " << prog << " [-n file_num] [-s file_size] [-d dup_ratio] [-k chunk_shift]"
+              << " [-w write_size] [-r read_size] [-C chunker] [-P min:avg:max] [-z compress] [-t text_ratio] [-e edits] [-D delta_depth] [-Z zero_ratio] [-g (sparse write)] [-I index] [-L index_cache] [-H index_sample] [-M index_champions] [-b write_buffer] [-T chunk_threads] [-S storage] [-G zone_size] [-N zone_num] [-V devices] [-U keep] [-J (journal)] [-j journal_size] [-F fsync_every] [-W writers] [-R (recover)] [-K (clone)] [-c rewrite_cap] [-l rewrite_limit] [-x (skip verify)]" << std::endl;
+}
+
+// build a file: each segment is either fresh random data or a copy of an earlier segment shifted by chunk_shift bytes
+static void make_file(const harness_config &conf, std::vector<char> &history, char *out, std::mt19937_64 &rng){
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    size_t pos = 0;
+    while (pos < conf.file_size){
+        size_t seg_len = std::min((size_t)HARNESS_SEGMENT_SIZE, conf.file_size - pos);
+        if (history.size() >= HARNESS_SEGMENT_SIZE && coin(rng) < conf.dup_ratio){
+            size_t shift = std::min(conf.chunk_shift, seg_len);
+            bench_fill_random(out + pos, shift, rng());
+            size_t src = (rng() % (history.size() / HARNESS_SEGMENT_SIZE)) * HARNESS_SEGMENT_SIZE;
+            memcpy(out + pos + shift, history.data() + src, seg_len - shift);
+            for (int edit = 0; edit < conf.edits; edit++) out[pos + rng() % seg_len] = (char)rng();
+        }
+        else if (coin(rng) < conf.zero_ratio){
+            memset(out + pos, 0, seg_len);
+        }
+        else{
+            if (coin(rng) < conf.text_ratio) bench_fill_text(out + pos, seg_len, rng());
+            else bench_fill_random(out + pos, seg_len, rng());
+            if (seg_len == HARNESS_SEGMENT_SIZE) history.insert(history.end(), out + pos, out + pos + seg_len);
+        }
+        pos += seg_len;
+    }
+}
+
+// counters and files shared by the scenarios of a run
+struct harness_state{
+    std::mt19937_64 rng{0};
+    std::vector<char> history;
+    std::vector<std::vector<char>> contents;    // files of the current generation, one per writer
+    std::vector<char> read_buf;
+    double write_time = 0, read_time = 0, fsync_time = 0, clone_time = 0, recover_time = 0;
+    uint64_t verify_fail = 0, data_extents = 0, fsync_num = 0, recovered_files = 0, recovered_records = 0;
+    uint64_t frag_size = 0, frag_runs = 0;
+    cdcfs_frag last_frag = {};      // of the last file, the latest backup generation
+    std::mutex fsync_stat_mutex;
+    std::deque<std::pair<std::string, std::vector<char>>> kept;     // files still alive with -U
+    std::vector<std::pair<std::string, std::vector<char>>> clones;  // clones read back at the end
+};
+
+// return false on a bad option
+static bool parse_args(int argc, char *argv[], harness_config &conf){
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:d:k:w:r:C:P:z:t:e:D:Z:gI:L:H:M:b:T:S:G:N:V:U:Jj:F:W:RKc:l:x")) != -1){
+        switch (opt){
+            case 'n': conf.file_num = atoi(optarg); break;
+            case 's': conf.file_size = strtoull(optarg, NULL, 0); break;
+            case 'd': conf.dup_ratio = atof(optarg); break;
+            case 'k': conf.chunk_shift = strtoull(optarg, NULL, 0); break;
+            case 'w': conf.write_size = strtoull(optarg, NULL, 0); break;
+            case 'r': conf.read_size = strtoull(optarg, NULL, 0); break;
+            case 'C': conf.chunker = optarg; break;
+            case 'P':
+                if (sscanf(optarg, "%u:%u:%u", &conf.chunk_min, &conf.chunk_avg, &conf.chunk_max) != 3) return false;
+                break;
+            case 'z': conf.compress = optarg; break;
+            case 't': conf.text_ratio = atof(optarg); break;
+            case 'e': conf.edits = atoi(optarg); break;
+            case 'D': conf.delta_depth = atoi(optarg); break;
+            case 'Z': conf.zero_ratio = atof(optarg); break;
+            case 'g': conf.sparse_write = true; break;
+            case 'I': conf.index = optarg; break;
+            case 'L': conf.index_cache = atoi(optarg); break;
+            case 'H': conf.index_sample = atoi(optarg); break;
+            case 'M': conf.index_champions = atoi(optarg); break;
+            case 'b': conf.write_buffer = strtoul(optarg, NULL, 0); break;
+            case 'T': conf.chunk_threads = atoi(optarg); break;
+            case 'S': conf.storage = optarg; break;
+            case 'G': conf.zone_size = atoi(optarg); break;
+            case 'N': conf.zone_num = atoi(optarg); break;
+            case 'V': conf.devices = atoi(optarg); break;
+            case 'U': conf.keep = atoi(optarg); break;
+            case 'J': conf.journal = true; break;
+            case 'j': conf.journal_size = atoi(optarg); break;
+            case 'F': conf.fsync_every = atoi(optarg); break;
+            case 'W': conf.writers = std::max(atoi(optarg), 1); break;
+            case 'R': conf.recover = conf.journal = true; break;
+            case 'K': conf.clone = true; break;
+            case 'c': conf.rewrite_cap = atoi(optarg); break;
+            case 'l': conf.rewrite_limit = atoi(optarg); break;
+            case 'x': conf.verify = false; break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+// set up CDCFS like main.cpp does from the mount options, return false if an option is rejected
+static bool harness_init(const harness_config &conf){
+    // clean backend, a recovery keeps what the last run left
+    std::filesystem::create_directories(BACKEND);
+    for (const auto& entry : std::filesystem::directory_iterator(BACKEND)){
+        if (conf.recover) break;
+        std::filesystem::remove_all(entry.path());
+    }
+    cdcfs_init_status();
+    if (conf.chunk_max > MAX_GROUP_SIZE || chunker_init(&cdc_chunker, conf.chunker, conf.chunk_min, conf.chunk_avg, conf.chunk_max) == -1){
+        PRINT_WARNING("harness: bad chunker " << conf.chunker << " or chunk_max > " << MAX_GROUP_SIZE);
+        return false;
+    }
+    if (compress_type_of(conf.compress) == -1){
+        PRINT_WARNING("harness: unsupported compression " << conf.compress);
+        return false;
+    }
+    group_compress_type = compress_type_of(conf.compress);
+    delta_max_depth = std::min(conf.delta_depth, (unsigned)DELTA_MAX_DEPTH);
+    write_buffer_size = std::min(std::max(conf.write_buffer, (uint32_t)MAX_GROUP_SIZE), (uint32_t)MAX_WRITE_BUFFER_SIZE);
+    chunk_threads = std::min(std::max(conf.chunk_threads, 1U), (unsigned)MAX_CHUNK_THREADS);
+    rewrite_init(conf.rewrite_cap, REWRITE_DEFAULT_SEGMENT, conf.rewrite_limit);
+    if (fp_index_mode_of(conf.index) == -1 || fp_index_init(fp_index_mode_of(conf.index), conf.index_cache, INDEX_DEFAULT_BLOOM,
+                                                                      conf.index_sample, conf.index_champions) == -1){
+        PRINT_WARNING("harness: bad index " << conf.index << " or " << INDEX_PATH << " not writable");
+        return false;
+    }
+    write_buffer_size = fp_index_write_buffer(write_buffer_size);
+    std::vector<std::string> device_roots;
+    for (uint32_t d = 0; conf.devices > 1 && d < conf.devices; d++) device_roots.push_back(std::string(ZONE_PATH) + "/dev_" + std::to_string(d));
+    if (storage_mode_of(conf.storage) == -1 || conf.zone_size == 0 || conf.zone_size > ZONE_MAX_SIZE
+        || zone_init(storage_mode_of(conf.storage), conf.zone_size, conf.zone_num, conf.recover, device_roots) == -1){
+        PRINT_WARNING("harness: bad storage " << conf.storage << " or " << ZONE_PATH << " not writable");
+        return false;
+    }
+    if (conf.journal_size == 0 || journal_init(conf.journal, conf.journal_size, zone_device_roots(), conf.recover) == -1){
+        PRINT_WARNING("harness: bad journal_size or " << JOURNAL_PATH << " not writable");
+        return false;
+    }
+    return true;
+}
+
+static bool fsync_file(harness_state &st, const std::string &path, struct fuse_file_info *fi){
+    double start = bench_now();
+    int res = cdcfs_fsync(path.c_str(), 0, fi);
+    std::lock_guard<std::mutex> fsync_stat_lock(st.fsync_stat_mutex);
+    st.fsync_time += bench_now() - start;
+    st.fsync_num++;
+    if (res != 0) PRINT_WARNING("harness: fsync " << path << " failed");
+    return res == 0;
+}
+
+static bool write_file(const harness_config &conf, harness_state &st, const std::string &path, const char *content){
+    struct fuse_file_info fi = {};
+    if (cdcfs_create(path.c_str(), 0644, &fi) != 0){
+        PRINT_WARNING("harness: create " << path << " failed");
+        return false;
+    }
+    int writes = 0;
+    for (size_t off = 0; off < conf.file_size; off += conf.write_size){
+        size_t len = std::min(conf.write_size, conf.file_size - off);
+        bool last = off + len == conf.file_size;
+        if (conf.sparse_write && !last && zero_prefix_length(content + off, len) == len) continue;
+        if (cdcfs_write(path.c_str(), content + off, len, off, &fi) != (int)len){
+            PRINT_WARNING("harness: write " << path << " at " << off << " failed");
+            return false;
+        }
+        if (conf.fsync_every > 0 && ++writes % conf.fsync_every == 0 && !fsync_file(st, path, &fi)) return false;
+    }
+    if (conf.fsync_every > 0 && !fsync_file(st, path, &fi)) return false;
+    cdcfs_release(path.c_str(), &fi);
+    return true;
+}
+
+// read a whole file back and count the blocks that differ from content
+static void verify_file(const harness_config &conf, harness_state &st, const std::string &path, const std::vector<char> &content, struct fuse_file_info *fi){
+    for (size_t off = 0; off < conf.file_size; off += conf.read_size){
+        size_t len = std::min(conf.read_size, conf.file_size - off);
+        int res = cdcfs_read(path.c_str(), st.read_buf.data(), len, off, fi);
+        if (conf.verify && (res != (int)len || memcmp(st.read_buf.data(), content.data() + off, len) != 0)) st.verify_fail++;
+    }
+}
+
+// dedup: write a generation of files, one writer thread per file. return false if a write failed
+static bool scenario_dedup(const harness_config &conf, harness_state &st, int first_idx, int file_num){
+    std::atomic<bool> write_ok(true);
+    double start = bench_now();
+    run_parallel(file_num, [&](unsigned w){
+        if (!write_file(conf, st, "/bench_" + std::to_string(first_idx + w), st.contents[w].data())) write_ok = false;
+    });
+    st.write_time += bench_now() - start;
+    return write_ok;
+}
+
+// read a file back, walk its data extents with SEEK_DATA / SEEK_HOLE and measure its fragmentation
+static void scenario_read(const harness_config &conf, harness_state &st, const std::string &path, const std::vector<char> &content){
+    struct fuse_file_info fi = {};
+    fi.flags = O_RDONLY;
+    double start = bench_now();
+    cdcfs_open(path.c_str(), &fi);
+    verify_file(conf, st, path, content, &fi);
+    st.read_time += bench_now() - start;
+    for (off_t data = cdcfs_lseek(path.c_str(), 0, SEEK_DATA, &fi); data >= 0; st.data_extents++){
+        off_t hole = cdcfs_lseek(path.c_str(), data, SEEK_HOLE, &fi);
+        data = cdcfs_lseek(path.c_str(), hole, SEEK_DATA, &fi);
+    }
+    if (cdcfs_ioctl(path.c_str(), CDCFS_IOC_FRAG, NULL, &fi, 0, &st.last_frag) == 0){
+        st.frag_size += st.last_frag.size;
+        st.frag_runs += st.last_frag.runs;
+    }
+    cdcfs_release(path.c_str(), &fi);
+}
+
+// clone: the first part with copy_file_range and the rest with the ioctl, both ends split groups
+static void scenario_clone(const harness_config &conf, harness_state &st, const std::string &path, const std::string &clone_path, const std::vector<char> &content){
+    struct fuse_file_info src_fi = {}, dst_fi = {};
+    src_fi.flags = O_RDONLY;
+    size_t split = std::min(conf.file_size, conf.file_size / 3 + 12345);
+    cdcfs_clone_arg arg = {};
+    snprintf(arg.src_path, sizeof(arg.src_path), "%s", path.c_str());
+    arg.src_offset = split;
+    double start = bench_now();
+    cdcfs_open(path.c_str(), &src_fi);
+    if (cdcfs_create(clone_path.c_str(), 0644, &dst_fi) != 0
+        || cdcfs_copy_file_range(path.c_str(), &src_fi, 0, clone_path.c_str(), &dst_fi, 0, split, 0) != (ssize_t)split
+        || cdcfs_ioctl(clone_path.c_str(), CDCFS_IOC_CLONE, NULL, &dst_fi, 0, &arg) != 0
+        || (conf.fsync_every > 0 && !fsync_file(st, clone_path, &dst_fi))){
+        PRINT_WARNING("harness: clone " << path << " failed");
+        st.verify_fail++;
+    }
+    cdcfs_release(clone_path.c_str(), &dst_fi);
+    cdcfs_release(path.c_str(), &src_fi);
+    st.clone_time += bench_now() - start;
+    st.clones.emplace_back(clone_path, content);
+}
+
+// unlink / reclaim: keep the last conf.keep files, older ones are unlinked (storage=zone only) so their zones
+// get reclaimed
+static void scenario_unlink(const harness_config &conf, harness_state &st, const std::string &path, const std::vector<char> &content){
+    st.kept.emplace_back(path, content);
+    if ((int)st.kept.size() > conf.keep && storage_mode == STORAGE_ZONE){
+        if (cdcfs_unlink(st.kept.front().first.c_str()) != 0) PRINT_WARNING("harness: unlink " << st.kept.front().first << " failed");
+        st.kept.pop_front();
+    }
+}
+
+// recover: replay the journal of the last run, its files are then read back instead of written
+static void scenario_recover(harness_state &st){
+    double start = bench_now();
+    st.recovered_records = journal_recover();
+    st.recover_time = bench_now() - start;
+}
+
+// files that survived read back again, their groups may have been moved by zone reclaim
+static void verify_survivors(const harness_config &conf, harness_state &st){
+    st.kept.insert(st.kept.end(), st.clones.begin(), st.clones.end());
+    for (const auto &[path, data] : st.kept){
+        struct fuse_file_info fi = {};
+        fi.flags = O_RDONLY;
+        cdcfs_open(path.c_str(), &fi);
+        verify_file(conf, st, path, data, &fi);
+        cdcfs_release(path.c_str(), &fi);
+    }
+}
+
+// devices: bytes written to the least / most loaded device
+static double device_balance(){
+    uint64_t device_min = UINT64_MAX, device_max = 0;
+    for (uint32_t d = 0; d < zone_device_num; d++){
+        device_min = std::min(device_min, zone_devices[d].written.load());
+        device_max = std::max(device_max, zone_devices[d].written.load());
+    }
+    return device_max ? (double)device_min / device_max : 0;
+}
+
+static void report(const harness_config &conf, harness_state &st){
+    uint32_t used_zones = 0;
+    uint64_t zone_written = 0, zone_live = 0;
+    zone_usage(&used_zones, &zone_written, &zone_live);
+    uint64_t total_bytes = (uint64_t)conf.file_num * conf.file_size;
+    BENCH_RESULT("harness", "\"files\":" << conf.file_num << ",\"file_size\":" << conf.file_size
+                 << ",\"dup_ratio\":" << conf.dup_ratio << ",\"chunk_shift\":" << conf.chunk_shift
+                 << ",\"text_ratio\":" << conf.text_ratio << ",\"edits\":" << conf.edits
+                 << ",\"chunker\":\"" << cdc_chunker.name << "\",\"chunk_avg\":" << cdc_chunker.param.av
+                 << ",\"write_size\":" << conf.write_size << ",\"read_size\":" << conf.read_size
+                 << ",\"write_buffer\":" << write_buffer_size << ",\"chunk_threads\":" << chunk_threads
+                 << ",\"zero_ratio\":" << conf.zero_ratio << ",\"sparse_write\":" << conf.sparse_write
+                 << ",\"unique_chunks\":" << fp_index_size() << ",\"data_extents\":" << st.data_extents
+                 << ",\"groups\":" << group_table_size() << ",\"group_memory\":" << group_table_memory()
+                 << ",\"index\":\"" << fp_index_name(index_mode) << "\",\"index_memory\":" << fp_index_memory()
+                 << ",\"index_cache_hits\":" << index_stat.cache_hits + index_stat.open_hits << ",\"index_bloom_skips\":" << index_stat.bloom_skips
+                 << ",\"index_disk_lookups\":" << index_stat.disk_lookups << ",\"index_segment_loads\":" << index_stat.segment_loads
+                 << ",\"index_sample\":" << index_sample_mask + 1 << ",\"index_hook_lookups\":" << index_stat.hook_lookups
+                 << ",\"index_sparse_segments\":" << index_stat.sparse_segments
+                 << ",\"dedup_rate\":" << (total_write_size ? (double)total_dedup_size / total_write_size : 0)
+                 << ",\"compress\":\"" << compress_name(group_compress_type) << "\",\"compress_saving\":" << total_compress_saving
+                 << ",\"delta_depth\":" << (int)delta_max_depth << ",\"delta_saving\":" << total_delta_saving
+                 << ",\"storage\":\"" << storage_name(storage_mode) << "\",\"zones_used\":" << used_zones
+                 << ",\"zone_utilization\":" << (zone_written ? (double)zone_live / zone_written : 0)
+                 << ",\"zone_resets\":" << zone_stats.resets << ",\"zone_migrated\":" << zone_stats.migrated
+                 << ",\"devices\":" << zone_device_num << ",\"device_balance\":" << device_balance()
+                 << ",\"journal\":" << journal_enabled << ",\"fsyncs\":" << st.fsync_num
+                 << ",\"fsync_avg_us\":" << (st.fsync_num ? st.fsync_time / st.fsync_num * 1000000 : 0)
+                 << ",\"group_commits\":" << journal_stats.flushes << ",\"checkpoints\":" << journal_stats.checkpoints
+                 << ",\"recovered_files\":" << st.recovered_files << ",\"recovered_records\":" << st.recovered_records
+                 << ",\"recover_ms\":" << st.recover_time * 1000
+                 << ",\"clones\":" << st.clones.size() << ",\"clone_MBps\":" << (st.clone_time > 0 ? st.clones.size() * conf.file_size / st.clone_time / 1000000 : 0)
+                 << ",\"rewrite_cap\":" << rewrite_cap << ",\"rewrite_limit\":" << rewrite_limit
+                 << ",\"rewritten\":" << rewrite_stats.bytes << ",\"runs_per_MB\":" << (st.frag_size ? (double)st.frag_runs / st.frag_size * 1000000 : 0)
+                 << ",\"last_runs_per_MB\":" << (st.last_frag.size ? (double)st.last_frag.runs / st.last_frag.size * 1000000 : 0)
+                 << ",\"last_containers\":" << st.last_frag.containers
+                 << ",\"write_MBps\":" << (st.write_time > 0 ? total_bytes / st.write_time / 1000000 : 0)
+                 << ",\"read_MBps\":" << (st.read_time > 0 ? total_bytes / st.read_time / 1000000 : 0)
+                 << ",\"verify_fail\":" << st.verify_fail);
+}
+
+// the driver: files are made generation by generation (conf.writers at once, every generation dedups against the
+// earlier ones), written or recovered, then read back, cloned and unlinked as the options ask
+int main(int argc, char *argv[]) {
+    harness_config conf;
+    if (!parse_args(argc, argv, conf)){
+        usage(argv[0]);
+        return 1;
+    }
+    if (!harness_init(conf)) return 1;
+    harness_state st;
+    if (conf.recover) scenario_recover(st);
+    st.contents.assign(conf.writers, std::vector<char>(conf.file_size));
+    st.read_buf.resize(conf.read_size);
+    for (int first_idx = 0; first_idx < conf.file_num; first_idx += conf.writers){
+        int file_num = std::min(conf.writers, conf.file_num - first_idx);
+        for (int w = 0; w < file_num; w++) make_file(conf, st.history, st.contents[w].data(), st.rng);
+        if (!conf.recover && !scenario_dedup(conf, st, first_idx, file_num)) return 1;
+        for (int w = 0; w < file_num; w++){
+            std::string path = "/bench_" + std::to_string(first_idx + w);
+            std::string clone_path = "/clone_" + std::to_string(first_idx + w);
+            const std::vector<char> &content = st.contents[w];
+            if (conf.clone && conf.recover && path_to_iNum.find(clone_path) != path_to_iNum.end()){
+                st.recovered_files++;
+                st.clones.emplace_back(clone_path, content);
+            }
+            if (conf.recover){
+                if (path_to_iNum.find(path) == path_to_iNum.end()) continue;   // unlinked by the last run
+                st.recovered_files++;
+            }
+            scenario_read(conf, st, path, content);
+            if (conf.clone && !conf.recover) scenario_clone(conf, st, path, clone_path, content);
+            if (conf.keep > 0 && !conf.recover) scenario_unlink(conf, st, path, content);
+        }
+    }
+    verify_survivors(conf, st);
+    report(conf, st);
+    return st.verify_fail ? 2 : 0;
+}
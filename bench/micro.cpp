@@ -0,0 +1,79 @@
+// microbenchmarks of the per chunk hot spots: content defined cut, fingerprinting and fp_store
+#include "../src/file.h"
+#include "bench.h"
+
+#define MICRO_DATA_SIZE (256 * 1024 * 1024)
+#define MICRO_FP_NUM 2000000
+
+static void bench_cut(const chunker &engine, const char *data, size_t len){
+    uint64_t chunk_cnt = 0;
+    size_t pos = 0;
+    double start = bench_now();
+    while (pos < len){
+        uint32_t remain = std::min(len - pos, (size_t)MAX_GROUP_SIZE);
+        pos += engine.cut((const uint8_t *)data + pos, remain, engine.param);
+        chunk_cnt++;
+    }
+    double elapsed = bench_now() - start;
+    BENCH_RESULT("cut", "\"chunker\":\"" << engine.name << "\",\"bytes\":" << len << ",\"chunks\":" << chunk_cnt
+                 << ",\"avg_chunk\":" << len / chunk_cnt << ",\"MBps\":" << len / elapsed / 1000000);
+}
+
+static void bench_fingerprint(const char *data, size_t len, size_t chunk_size){
+    char cur_fp[SHA_DIGEST_LENGTH];
+    uint64_t chunk_cnt = 0;
+    double start = bench_now();
+    for (size_t pos = 0; pos + chunk_size <= len; pos += chunk_size, chunk_cnt++){
+        SHA1((const unsigned char *)data + pos, chunk_size, (unsigned char *)cur_fp);
+    }
+    double elapsed = bench_now() - start;
+    BENCH_RESULT("sha1", "\"chunk_size\":" << chunk_size << ",\"chunks\":" << chunk_cnt
+                 << ",\"MBps\":" << chunk_cnt * chunk_size / elapsed / 1000000);
+}
+
+static void bench_fp_store(){
+    std::vector<FP_TYPE> fps;
+    fps.reserve(MICRO_FP_NUM * 2);
+    char raw_fp[SHA_DIGEST_LENGTH];
+    for (uint64_t i = 0; i < MICRO_FP_NUM * 2; i++){
+        bench_fill_random(raw_fp, SHA_DIGEST_LENGTH, i);
+        fps.push_back(FP_TYPE(raw_fp, SHA_DIGEST_LENGTH));
+    }
+    decltype(fp_store) store;
+
+    double start = bench_now();
+    for (uint64_t i = 0; i < MICRO_FP_NUM; i++) store[fps[i]] = (GROUP_ID_TYPE)(i + 1);
+    double insert_elapsed = bench_now() - start;
+
+    uint64_t hit = 0;
+    start = bench_now();
+    for (uint64_t i = 0; i < MICRO_FP_NUM; i++) hit += store.find(fps[i]) != store.end();
+    double hit_elapsed = bench_now() - start;
+
+    uint64_t miss = 0;
+    start = bench_now();
+    for (uint64_t i = MICRO_FP_NUM; i < MICRO_FP_NUM * 2; i++) miss += store.find(fps[i]) == store.end();
+    double miss_elapsed = bench_now() - start;
+
+    BENCH_RESULT("fp_store_insert", "\"ops\":" << MICRO_FP_NUM << ",\"Mops\":" << MICRO_FP_NUM / insert_elapsed / 1000000);
+    BENCH_RESULT("fp_store_lookup_hit", "\"ops\":" << hit << ",\"Mops\":" << hit / hit_elapsed / 1000000);
+    BENCH_RESULT("fp_store_lookup_miss", "\"ops\":" << miss << ",\"Mops\":" << miss / miss_elapsed / 1000000);
+}
+
+int main(int argc, char *argv[]) {
+    char *data = new char[MICRO_DATA_SIZE];
+    bench_fill_random(data, MICRO_DATA_SIZE, 0);
+
+    for (const chunker_entry &entry : chunker_table){
+        chunker engine;
+        chunker_init(&engine, entry.name, 0, BLOCK_SIZE, MAX_GROUP_SIZE);
+        bench_cut(engine, data, MICRO_DATA_SIZE);
+    }
+    for (size_t chunk_size = BLOCK_SIZE / 2; chunk_size <= MAX_GROUP_SIZE; chunk_size *= 2){
+        bench_fingerprint(data, MICRO_DATA_SIZE, chunk_size);
+    }
+    bench_fp_store();
+
+    delete[] data;
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef CDCFS_IOCTL_H
+#define CDCFS_IOCTL_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// ioctls of CDCFS, also included by tools calling them on a file of the mount.
+// FICLONE can't be used: its argument is a file descriptor of the caller, which FUSE doesn't pass to the file system.
+
+// CDCFS_IOC_CLONE: append length bytes of src_path at src_offset to the end of the file the ioctl is called on, by
+// sharing the groups of src_path (ref++) instead of copying their bytes. src_path is relative to the mount point
+// ("/dir/file"), length 0 clones until the end of the source.
+struct cdcfs_clone_arg{
+    char src_path[1024];
+    uint64_t src_offset;
+    uint64_t length;
+};
+
+#define CDCFS_IOC_CLONE _IOW('C', 1, struct cdcfs_clone_arg)
+
+// CDCFS_IOC_FRAG: read fragmentation of the file the ioctl is called on. A sequential read opens a container
+// (backend file or zone) for every run, so runs per MB of size is what slows its restore down.
+struct cdcfs_frag{
+    uint64_t size;          // logical bytes mapped
+    uint64_t groups;        // groups holding data, holes excluded
+    uint64_t runs;          // stretches of consecutive data groups in the same container
+    uint64_t containers;    // distinct containers holding its data
+};
+
+#define CDCFS_IOC_FRAG _IOR('C', 2, struct cdcfs_frag)
+
+#endif /* CDCFS_IOCTL_H */
@@ -0,0 +1,242 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <stdint.h>
+#include <string.h>
+#include "fastcdc.h"
+
+// Chunking engines selectable at mount time. Every engine is a struct with a static setup() that derives
+// its parameters (masks, window...) from the sizes, and a static cut() that reads them from chunker_param,
+// the runtime choice is only one indirect call per chunk.
+
+struct chunker_param{
+    uint32_t mi;        // minimum chunk size
+    uint32_t av;        // expected chunk size
+    uint32_t ma;        // maximum chunk size
+    uint32_t ns;        // normal size, stricter mask before it (FastCDC / gear64)
+    uint64_t mask_s;    // mask used before normal size
+    uint64_t mask_l;    // mask used after normal size
+    uint32_t window;    // window size (Rabin / AE / RAM)
+};
+
+typedef uint32_t (*chunker_cut_fn)(const uint8_t *src, uint32_t len, const chunker_param &param);
+
+struct chunker{
+    const char *name;
+    chunker_param param;
+    chunker_cut_fn cut;
+};
+
+static inline uint32_t chunker_bits(uint32_t av){
+    return (uint32_t)round(log2(av));
+}
+
+// FastCDC with 32-bit gear hash, NORM_LEVEL is the normalized chunking level of the paper (0: none),
+// it only picks the masks in setup(), every level shares the cut() loop of fastcdc.h.
+template <int NORM_LEVEL>
+struct fastcdc_engine{
+    static void setup(chunker_param &param){
+        fcdc_ctx cdc = fastcdc_init(param.mi, param.av, param.ma);
+        uint32_t bits = chunker_bits(cdc.av);
+        param.mi = cdc.mi;
+        param.av = cdc.av;
+        param.ma = cdc.ma;
+        param.ns = cdc.ns;
+        param.mask_s = FASTCDC_MASK(bits + NORM_LEVEL);
+        param.mask_l = FASTCDC_MASK(bits - NORM_LEVEL);
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        return ::cut(src, len, param.mi, param.ma, param.ns, (uint32_t)param.mask_s, (uint32_t)param.mask_l);
+    }
+};
+
+// 64-bit gear table generated by splitmix64 at compile time
+struct gear64_table{
+    uint64_t v[256];
+    constexpr gear64_table() : v() {
+        uint64_t state = 0x5C95C07822408989ULL;
+        for (int i = 0; i < 256; i++){
+            state += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            v[i] = z ^ (z >> 31);
+        }
+    }
+};
+static constexpr gear64_table GEAR64{};
+
+// FastCDC with 64-bit gear hash, the hash is shifted left so the mask uses the high (best mixed) bits
+struct gear64_engine{
+    static void setup(chunker_param &param){
+        fastcdc_engine<1>::setup(param);
+        uint32_t bits = chunker_bits(param.av);
+        param.mask_s = ~0ULL << (64 - (bits + 1));
+        param.mask_l = ~0ULL << (64 - (bits - 1));
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        const uint64_t mask_s = param.mask_s, mask_l = param.mask_l;
+        uint64_t fp = 0;
+        uint32_t i = (len < param.mi) ? len : param.mi;
+        uint32_t n = (param.ns < len) ? param.ns : len;
+        for (; i < n; i++){
+            fp = (fp << 1) + GEAR64.v[src[i]];
+            if ((fp & mask_s) == 0) return i + 1;
+        }
+        n = (param.ma < len) ? param.ma : len;
+        for (; i < n; i++){
+            fp = (fp << 1) + GEAR64.v[src[i]];
+            if ((fp & mask_l) == 0) return i + 1;
+        }
+        return i;
+    }
+};
+
+// Rabin fingerprint over GF(2) with a sliding window (LBFS style), tables are built at compile time
+#define RABIN_POLY 0x3DA3358B4DC173ULL
+#define RABIN_DEGREE 53
+#define RABIN_SHIFT (RABIN_DEGREE - 8)
+#define RABIN_WINDOW 48
+
+struct rabin_table{
+    uint64_t mod[256];  // reduce the byte shifted out of the degree
+    uint64_t out[256];  // remove the byte leaving the window
+    static constexpr uint64_t poly_mod(uint64_t x){
+        for (int bit = 63; bit >= RABIN_DEGREE; bit--){
+            if ((x >> bit) & 1) x ^= RABIN_POLY << (bit - RABIN_DEGREE);
+        }
+        return x;
+    }
+    constexpr rabin_table() : mod(), out() {
+        for (uint64_t b = 0; b < 256; b++){
+            mod[b] = poly_mod(b << RABIN_DEGREE) | (b << RABIN_DEGREE);
+            uint64_t h = poly_mod(b);
+            for (int i = 0; i < RABIN_WINDOW - 1; i++) h = poly_mod(h << 8);
+            out[b] = h;
+        }
+    }
+};
+static constexpr rabin_table RABIN{};
+
+struct rabin_engine{
+    static void setup(chunker_param &param){
+        param.mi = FASTCDC_CLAMP(param.mi, RABIN_WINDOW, param.av);
+        param.mask_l = (1ULL << chunker_bits(param.av)) - 1;
+        param.window = RABIN_WINDOW;
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        const uint64_t mask = param.mask_l;
+        uint32_t n = (param.ma < len) ? param.ma : len;
+        if (n <= param.mi) return n;
+        // start one window before the minimum size, so the fingerprint only depends on the window content
+        uint32_t start = param.mi - RABIN_WINDOW, i = start;
+        uint64_t digest = 0;
+        for (; i < param.mi; i++){
+            digest = ((digest << 8) | src[i]) ^ RABIN.mod[digest >> RABIN_SHIFT];
+        }
+        for (; i < n; i++){
+            digest ^= RABIN.out[src[i - RABIN_WINDOW]];
+            digest = ((digest << 8) | src[i]) ^ RABIN.mod[digest >> RABIN_SHIFT];
+            if ((digest & mask) == mask) return i + 1;  // "== mask" so runs of zero don't produce minimum chunks
+        }
+        return n;
+    }
+};
+
+// Asymmetric Extremum: cut when the maximum value stays unbeaten for a whole window after it.
+// Values are the 8 bytes starting at each position, single bytes tie too often.
+struct ae_engine{
+    static void setup(chunker_param &param){
+        param.window = param.av * 1000 / 1718;     // expected chunk size is (e - 1) * window
+        if (param.window == 0) param.window = 1;
+        param.mi = FASTCDC_CLAMP(param.mi, 0, param.av);
+    }
+    static inline uint64_t value_at(const uint8_t *src){
+        uint64_t v;
+        memcpy(&v, src, sizeof(v));
+        return v;
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        const uint32_t window = param.window, mi = param.mi;
+        uint32_t n = (param.ma < len) ? param.ma : len;
+        if (n < sizeof(uint64_t)) return n;
+        uint32_t end = n - sizeof(uint64_t) + 1, max_pos = 0;
+        uint64_t max_val = value_at(src);
+        for (uint32_t i = 1; i < end; i++){
+            uint64_t cur = value_at(src + i);
+            if (cur > max_val){
+                max_val = cur;
+                max_pos = i;
+            }
+            else if (i - max_pos >= window && i + 1 >= mi) return i + 1;
+        }
+        return n;
+    }
+};
+
+// Rapid Asymmetric Maximum: the maximum byte of a fixed window at the chunk start is the threshold,
+// cut at the first byte reaching it.
+struct ram_engine{
+    static void setup(chunker_param &param){
+        param.window = param.av > 256 ? param.av - 256 : param.av / 2;    // a byte >= window maximum comes every ~256 bytes
+        param.mi = FASTCDC_CLAMP(param.mi, 0, param.window);
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        uint32_t n = (param.ma < len) ? param.ma : len;
+        uint32_t window = param.window < n ? param.window : n;
+        uint8_t max_val = 0;
+        for (uint32_t i = 0; i < window; i++){
+            if (src[i] > max_val) max_val = src[i];
+        }
+        for (uint32_t i = window; i < n; i++){
+            if (src[i] >= max_val) return i + 1;
+        }
+        return n;
+    }
+};
+
+// fixed sized chunking (CAFTL)
+struct fixed_engine{
+    static void setup(chunker_param &param){
+        param.mi = param.ma = param.av;
+    }
+    static uint32_t cut(const uint8_t *src, uint32_t len, const chunker_param &param){
+        return (param.av < len) ? param.av : len;
+    }
+};
+
+struct chunker_entry{
+    const char *name;
+    void (*setup)(chunker_param &param);
+    chunker_cut_fn cut;
+};
+
+static const chunker_entry chunker_table[] = {
+    {"fastcdc", fastcdc_engine<1>::setup, fastcdc_engine<1>::cut},
+    {"fastcdc0", fastcdc_engine<0>::setup, fastcdc_engine<0>::cut},
+    {"fastcdc2", fastcdc_engine<2>::setup, fastcdc_engine<2>::cut},
+    {"fastcdc3", fastcdc_engine<3>::setup, fastcdc_engine<3>::cut},
+    {"gear64", gear64_engine::setup, gear64_engine::cut},
+    {"rabin", rabin_engine::setup, rabin_engine::cut},
+    {"ae", ae_engine::setup, ae_engine::cut},
+    {"ram", ram_engine::setup, ram_engine::cut},
+    {"fixed", fixed_engine::setup, fixed_engine::cut},
+};
+
+// return -1 if there is no engine called name
+inline int chunker_init(chunker *c, const char *name, uint32_t mi, uint32_t av, uint32_t ma){
+    for (const chunker_entry &entry : chunker_table){
+        if (strcmp(entry.name, name) != 0) continue;
+        c->name = entry.name;
+        c->param = {};
+        c->param.mi = mi;
+        c->param.av = av;
+        c->param.ma = ma;
+        entry.setup(c->param);
+        c->cut = entry.cut;
+        return 0;
+    }
+    return -1;
+}
+
+#endif /* CHUNKER_H */
@@ -0,0 +1,101 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#ifdef COMPRESS
+#include <lz4.h>
+#include <zstd.h>
+#endif
+
+// Per group compression of unique groups. A group is stored compressed only when it saves at least
+// 1/COMPRESS_MIN_SAVING of its size, otherwise it is stored raw and read without any extra cost.
+
+#define COMPRESS_NONE 0
+#define COMPRESS_LZ4 1
+#define COMPRESS_ZSTD 2
+
+#define COMPRESS_MIN_LENGTH 512     // smaller groups are never compressed
+#define COMPRESS_MIN_SAVING 8       // compressed size must be <= length - length / COMPRESS_MIN_SAVING
+#define COMPRESS_SAMPLE_RUN 16      // sampled bytes are taken in runs of COMPRESS_SAMPLE_RUN bytes
+#define COMPRESS_SAMPLE_SIZE 512    // bytes sampled by the entropy check
+#define COMPRESS_MAX_ENTROPY 7.2    // bits per byte, sampled groups above it are stored raw without trying
+#define COMPRESS_BOUND(len) ((len) + (len) / 255 + 64)  // enough for lz4 and zstd output of len bytes
+
+// -c * log2(c) for every possible sample count, so the entropy check needs no log2() call
+struct entropy_table{
+    double v[COMPRESS_SAMPLE_SIZE + 1];
+    entropy_table(){
+        v[0] = 0;
+        for (int c = 1; c <= COMPRESS_SAMPLE_SIZE; c++) v[c] = c * log2(c);
+    }
+};
+static const entropy_table ENTROPY;
+
+inline const char *compress_name(uint8_t type){
+    switch (type){
+        case COMPRESS_LZ4: return "lz4";
+        case COMPRESS_ZSTD: return "zstd";
+        default: return "none";
+    }
+}
+
+// return -1 if name is unknown or this build has no compression
+inline int compress_type_of(const char *name){
+    if (strcmp(name, "none") == 0) return COMPRESS_NONE;
+#ifdef COMPRESS
+    if (strcmp(name, "lz4") == 0) return COMPRESS_LZ4;
+    if (strcmp(name, "zstd") == 0) return COMPRESS_ZSTD;
+#endif
+    return -1;
+}
+
+// estimate the byte entropy from a few runs of the group, so incompressible data is rejected quickly
+inline bool compress_worth_trying(const char *src, uint32_t len){
+    if (len < COMPRESS_MIN_LENGTH) return false;
+    uint16_t hist[256] = {};
+    uint32_t run_num = COMPRESS_SAMPLE_SIZE / COMPRESS_SAMPLE_RUN;
+    uint32_t stride = (len - COMPRESS_SAMPLE_RUN) / (run_num - 1);
+    for (uint32_t run = 0; run < run_num; run++){
+        const uint8_t *cur = (const uint8_t *)src + run * stride;
+        for (int i = 0; i < COMPRESS_SAMPLE_RUN; i++) hist[cur[i]]++;
+    }
+    double sum = 0;
+    for (int b = 0; b < 256; b++) sum += ENTROPY.v[hist[b]];
+    double entropy = log2(COMPRESS_SAMPLE_SIZE) - sum / COMPRESS_SAMPLE_SIZE;
+    return entropy <= COMPRESS_MAX_ENTROPY;
+}
+
+// compress len bytes of src into out (at least COMPRESS_BOUND(len) bytes).
+// return the compressed length, or 0 if the group should be stored raw.
+inline uint32_t compress_group(const char *src, uint32_t len, char *out, uint8_t type, int level){
+    if (type == COMPRESS_NONE || !compress_worth_trying(src, len)) return 0;
+    uint32_t limit = len - len / COMPRESS_MIN_SAVING;
+    int64_t res = 0;
+#ifdef COMPRESS
+    if (type == COMPRESS_LZ4){
+        res = LZ4_compress_fast(src, out, len, limit, level > 0 ? level : 1);     // 0: did not fit in limit
+    }
+    else if (type == COMPRESS_ZSTD){
+        size_t zres = ZSTD_compress(out, COMPRESS_BOUND(len), src, len, level);
+        res = ZSTD_isError(zres) ? 0 : zres;
+    }
+#endif
+    return (res > 0 && res <= limit) ? res : 0;
+}
+
+// decompress a stored group, return false if it is corrupted
+inline bool decompress_group(const char *src, uint32_t stored_len, char *out, uint32_t len, uint8_t type){
+#ifdef COMPRESS
+    if (type == COMPRESS_LZ4){
+        return LZ4_decompress_safe(src, out, stored_len, len) == (int)len;
+    }
+    if (type == COMPRESS_ZSTD){
+        return ZSTD_decompress(out, len, src, stored_len) == len;
+    }
+#endif
+    return false;
+}
+
+#endif /* COMPRESS_H */
@@ -3,34 +3,65 @@
 #ifndef DEF_H
 #define DEF_H
 
+#ifndef BACKEND
 #define BACKEND "/home/johnnychang/CDCFS/bak"
+#endif
+#ifndef INDEX_PATH
+#define INDEX_PATH "/home/johnnychang/CDCFS/index"   // on-disk fingerprint index ("-o index=locality"), outside BACKEND
+#endif
+#ifndef ZONE_PATH
+#define ZONE_PATH "/home/johnnychang/CDCFS/zones"   // zone emulator files ("-o storage=zone"), outside BACKEND
+#endif
+#ifndef JOURNAL_PATH
+#define JOURNAL_PATH "/home/johnnychang/CDCFS/journal"   // metadata journal and checkpoint ("-o journal"), outside BACKEND
+#endif
 #define MAPPING_OUTPUT_PATH "/home/johnnychang/result/mapping.txt"
 #define MAX_GROUP_SIZE 32768
 #define BLOCK_SIZE 4096
+#define DEFAULT_WRITE_BUFFER_SIZE (8 * MAX_GROUP_SIZE)  // staging buffer of every writing handler ("-o write_buffer=")
+#define MAX_WRITE_BUFFER_SIZE (1 << 30)
+#define PARALLEL_CHUNK_SEGMENT (8 * MAX_GROUP_SIZE)     // smallest buffer segment cut by its own thread
+#define MAX_CHUNK_THREADS 64
 #define MAX_REC_RD_REQ 1024
 #define READ_REQ_OUTPUT_PATH "/home/johnnychang/result/rdReq.txt"
 
+// chunking engine used when no "-o chunker=" is given (see chunker.h for the list)
+#ifdef CAFTL
+#define DEFAULT_CHUNKER "fixed"
+#else
+#define DEFAULT_CHUNKER "fastcdc"
+#endif
+
 // don't change it!
 #define MAX_INODE_NUM 1048576
 #define MAX_FILE_HANDLER 256
+#define MAPPING_LOCK_NUM 1024   // mapping tables share MAPPING_LOCK_NUM locks, by iNum
 
 // type define
 #define INUM_TYPE unsigned long
 #define FP_TYPE std::string
 #define PATH_TYPE std::string
 #define FILE_HANDLER_INDEX_TYPE uint8_t
+#define GROUP_ID_TYPE uint32_t      // handle of a group in the group table (group_table.h)
+
+#define HOLE_INUM ((INUM_TYPE)-1)   // iNum of hole groups, they have no data in any backend file
+#define FREED_INUM ((INUM_TYPE)-2)  // iNum of dead groups whose zone has been reclaimed
 
+// a group lives in a slab of the group table, its reference count is kept apart in group_ref(id)
 struct group_addr{
     INUM_TYPE iNum;
     uint32_t start_byte;    // start byte in that file
     uint16_t group_length;  // the length of this group
-    uint8_t ref_times;      // how many times this group is referenced
+    uint16_t stored_length; // the length of this group in disk (< group_length if compressed)
+    uint8_t compress_type;  // COMPRESS_NONE / COMPRESS_LZ4 / COMPRESS_ZSTD
+    uint8_t delta_depth;    // 0: stored by itself, n: stored as a delta of delta_base (depth n - 1)
+    GROUP_ID_TYPE delta_base;   // the group this group is delta encoded against, NO_GROUP if none
 };
 
 struct mapping_table_entry{
-    std::vector<int> group_idx;                 // the group index of each "BLOCK"
-    std::vector<off_t> group_offset;    // the start byte of every group in this file
-    std::vector<group_addr *> group_pos;        // The position of every Group
+    std::vector<off_t> group_offset;    // the start byte of every group in this file, sorted
+    uint64_t mapped_end = 0;                    // the end of the last group, a trailing hole runs until here
+    std::vector<GROUP_ID_TYPE> group_pos;       // The position of every Group
     std::vector<FP_TYPE> fp_list;               // fingerprint of every Group
     unsigned long logical_size_for_host = 0;    // the file size host will see(before dedup)
     unsigned long actual_size_in_disk = 0;      // the file size in disk(after dedup)
@@ -38,7 +69,7 @@ struct mapping_table_entry{
 
 struct buffer_entry{
     off_t start_byte;   // which bytes to start
-    uint16_t byte_cnt;  // how many bytes in buffer
+    uint32_t byte_cnt;  // how many bytes in buffer
     char *content = NULL;   // the content
 };
 
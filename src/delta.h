@@ -0,0 +1,139 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "fastcdc.h"
+
+// Resemblance detection and delta encoding of near-duplicate groups.
+// Super features follow Finesse: the group is split into SF_NUM * SF_FEATURE_NUM sub-groups, the feature of a
+// sub-group is the maximum gear hash inside it, and SF_FEATURE_NUM features are hashed into one super feature.
+// Two groups sharing any super feature are very likely similar.
+
+#define SF_NUM 3                // super features per group
+#define SF_FEATURE_NUM 4        // features hashed into one super feature
+#define DELTA_MIN_LENGTH 256    // smaller groups are never delta encoded
+#define DELTA_MAX_RATIO 2       // delta must be <= length / DELTA_MAX_RATIO, otherwise the group is not similar enough
+#define DELTA_MIN_MATCH 8       // shortest copy from the base
+#define DELTA_HASH_BITS 14      // hash table of base positions
+#define DELTA_MAX_DEPTH 8       // longest delta chain allowed by "-o delta_depth="
+
+#define DELTA_OP_INSERT 0       // op, u16 length, bytes
+#define DELTA_OP_COPY 1         // op, u16 base offset, u16 length
+
+static inline uint64_t sf_mix(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// compute SF_NUM super features of a group, return false if it is too small to have meaningful features
+inline bool sf_compute(const char *src, uint32_t len, uint64_t sf[SF_NUM]){
+    if (len < DELTA_MIN_LENGTH) return false;
+    const uint8_t *data = (const uint8_t *)src;
+    uint32_t feature[SF_NUM * SF_FEATURE_NUM];
+    uint32_t sub_len = len / (SF_NUM * SF_FEATURE_NUM), fp = 0, i = 0;
+    for (int f = 0; f < SF_NUM * SF_FEATURE_NUM; f++){
+        uint32_t end = (f == SF_NUM * SF_FEATURE_NUM - 1) ? len : i + sub_len, max_fp = 0;
+        for (; i < end; i++){
+            fp = (fp << 1) + GEAR[data[i]];
+            max_fp = std::max(max_fp, fp);
+        }
+        feature[f] = max_fp;
+    }
+    for (int s = 0; s < SF_NUM; s++){
+        uint64_t h = s + 1;
+        for (int f = 0; f < SF_FEATURE_NUM; f++) h = sf_mix(h ^ feature[f * SF_NUM + s]);
+        sf[s] = h;
+    }
+    return true;
+}
+
+static inline uint32_t delta_hash(const uint8_t *src){
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    return (v * 0x9E3779B97F4A7C15ULL) >> (64 - DELTA_HASH_BITS);
+}
+
+static inline void delta_put_u16(char *out, uint32_t &pos, uint16_t v){
+    out[pos++] = v & 0xff;
+    out[pos++] = v >> 8;
+}
+
+static inline uint16_t delta_get_u16(const char *in, uint32_t pos){
+    return (uint8_t)in[pos] | ((uint8_t)in[pos + 1] << 8);
+}
+
+// encode target as copies from base and inserted bytes into out (at least limit + 5 bytes).
+// return the encoded length, or 0 if it is longer than limit.
+inline uint32_t delta_encode(const char *target, uint32_t len, const char *base, uint32_t base_len, char *out, uint32_t limit){
+    const uint8_t *t = (const uint8_t *)target, *b = (const uint8_t *)base;
+    static thread_local int32_t table[1 << DELTA_HASH_BITS];
+    std::fill(table, table + (1 << DELTA_HASH_BITS), -1);
+    for (uint32_t i = 0; i + DELTA_MIN_MATCH <= base_len; i++) table[delta_hash(b + i)] = i;
+
+    uint32_t out_len = 0, i = 0, insert_start = 0;
+    auto flush_insert = [&](uint32_t end) -> bool {
+        while (insert_start < end){
+            uint32_t n = std::min(end - insert_start, (uint32_t)UINT16_MAX);
+            if (out_len + 3 + n > limit) return false;
+            out[out_len++] = DELTA_OP_INSERT;
+            delta_put_u16(out, out_len, n);
+            memcpy(out + out_len, target + insert_start, n);
+            out_len += n;
+            insert_start += n;
+        }
+        return true;
+    };
+    while (i + DELTA_MIN_MATCH <= len){
+        int32_t cand = table[delta_hash(t + i)];
+        if (cand < 0 || memcmp(t + i, b + cand, DELTA_MIN_MATCH) != 0){
+            i++;
+            continue;
+        }
+        uint32_t match_start = i, base_start = cand, match_end = i + DELTA_MIN_MATCH, base_end = cand + DELTA_MIN_MATCH;
+        while (match_end < len && base_end < base_len && t[match_end] == b[base_end]) match_end++, base_end++;
+        while (match_start > insert_start && base_start > 0 && t[match_start - 1] == b[base_start - 1]) match_start--, base_start--;
+        if (!flush_insert(match_start)) return 0;
+        for (uint32_t copied = 0; copied < match_end - match_start; ){
+            uint32_t n = std::min(match_end - match_start - copied, (uint32_t)UINT16_MAX);
+            if (out_len + 5 > limit) return 0;
+            out[out_len++] = DELTA_OP_COPY;
+            delta_put_u16(out, out_len, base_start + copied);
+            delta_put_u16(out, out_len, n);
+            copied += n;
+        }
+        i = insert_start = match_end;
+    }
+    if (!flush_insert(len)) return 0;
+    return out_len;
+}
+
+// rebuild a group of len bytes from its delta and base, return false if the delta is corrupted
+inline bool delta_decode(const char *delta, uint32_t delta_len, const char *base, uint32_t base_len, char *out, uint32_t len){
+    uint32_t pos = 0, out_len = 0;
+    while (pos < delta_len){
+        if (delta[pos] == DELTA_OP_INSERT && pos + 3 <= delta_len){
+            uint32_t n = delta_get_u16(delta, pos + 1);
+            pos += 3;
+            if (pos + n > delta_len || out_len + n > len) return false;
+            memcpy(out + out_len, delta + pos, n);
+            pos += n;
+            out_len += n;
+        }
+        else if (delta[pos] == DELTA_OP_COPY && pos + 5 <= delta_len){
+            uint32_t base_off = delta_get_u16(delta, pos + 1), n = delta_get_u16(delta, pos + 3);
+            pos += 5;
+            if (base_off + n > base_len || out_len + n > len) return false;
+            memcpy(out + out_len, base + base_off, n);
+            out_len += n;
+        }
+        else return false;
+    }
+    return out_len == len;
+}
+
+#endif /* DELTA_H */
@@ -2,7 +2,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <openssl/sha.h>
 #include <string>
@@ -13,27 +16,57 @@
 #include <cmath>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include "def.h"
-#include "fastcdc.h"
+#include "chunker.h"
+#include "compress.h"
+#include "delta.h"
+#include "hole.h"
+#include "rewrite.h"
+#include "fp_index.h"
+#include "journal.h"
+#include "zone.h"
+#include "cdcfs_ioctl.h"
 
 PATH_TYPE iNum_to_path[MAX_INODE_NUM];
 std::unordered_map<PATH_TYPE, INUM_TYPE> path_to_iNum;
 std::set<INUM_TYPE> free_iNum;
-std::unordered_map<FP_TYPE, group_addr *> fp_store;
+std::unordered_map<uint64_t, GROUP_ID_TYPE> sf_store; // super feature -> latest group having it (resemblance detection)
 std::set<FILE_HANDLER_INDEX_TYPE> free_file_handler;
 file_handler_data file_handler[MAX_FILE_HANDLER];   // get iNum by file handler (faster than get by file path)
 mapping_table_entry mapping_table[MAX_INODE_NUM];
 
 std::shared_mutex create_file_mutex;    // the lock for create new file
-std::shared_mutex fp_store_mutex;       // the lock for access fp_store
+std::shared_mutex sf_store_mutex;       // the lock for access sf_store
 std::shared_mutex file_handler_mutex;   // the lock for allocate file handler and free file handler
 std::shared_mutex status_record_mutex;  // the lock for recording file system status
 std::shared_mutex chunker_mutex;        // the lock for access chunker
+std::shared_mutex mapping_mutex[MAPPING_LOCK_NUM];  // the locks for the group vectors of mapping tables, unique to append
 
 unsigned long total_write_size = 0;     // total size of writed file in this file system
 unsigned long total_dedup_size = 0;     // total size of writed file in this file system after deduplication
+unsigned long total_compress_saving = 0;    // bytes saved by compressing unique groups
+unsigned long total_delta_saving = 0;       // bytes saved by delta encoding near-duplicate groups
 
-fcdc_ctx cdc, *ctx;
+uint8_t group_compress_type = COMPRESS_NONE;    // compression of new unique groups, chosen at mount time
+int group_compress_level = 1;                   // lz4 acceleration / zstd level
+uint8_t delta_max_depth = 0;                    // longest delta chain, 0: no delta encoding
+
+chunker cdc_chunker;                    // chunking engine chosen at mount time
+uint32_t write_buffer_size = DEFAULT_WRITE_BUFFER_SIZE;    // staging buffer of every writing handler
+unsigned chunk_threads = 1;             // threads cutting and hashing one write buffer
+
+// init CDCFS data structure and chunking engine, shared by main() and the bench harness
+inline void cdcfs_init_status(){
+    for (INUM_TYPE iNum = 0; iNum < MAX_INODE_NUM - 1; ++iNum) {
+        free_iNum.insert(iNum);
+    }
+    for(FILE_HANDLER_INDEX_TYPE file_handler = 0; file_handler < MAX_FILE_HANDLER - 1; ++file_handler){
+        free_file_handler.insert(file_handler);
+    }
+    // init default chunking engine, main() may replace it by mount options
+    chunker_init(&cdc_chunker, DEFAULT_CHUNKER, 0, BLOCK_SIZE, MAX_GROUP_SIZE);
+}
 
 inline INUM_TYPE get_inum(PATH_TYPE path_str){
     std::shared_lock<std::shared_mutex> shared_create_file_lock(create_file_mutex);     // make sure nobody is creating new file at the same time
@@ -43,6 +76,7 @@ inline INUM_TYPE get_inum(PATH_TYPE path_str){
         return it->second;
     }
     else {
+        std::shared_lock<std::shared_mutex> shared_journal_checkpoint_lock(journal_checkpoint_mutex);
         std::unique_lock<std::shared_mutex> unique_create_file_lock(create_file_mutex); // lock for creating new file
         if (free_iNum.empty()){
             PRINT_WARNING("run out of iNum");
@@ -52,6 +86,7 @@ inline INUM_TYPE get_inum(PATH_TYPE path_str){
         free_iNum.erase(free_iNum.begin());
         path_to_iNum[path_str] = new_iNum;
         iNum_to_path[new_iNum] = path_str;
+        journal_log_file(new_iNum, path_str);
         return new_iNum;
     }
 }
@@ -87,14 +122,429 @@ inline void init_file_handler(const char *path, FILE_HANDLER_INDEX_TYPE file_han
         .mode = mode,
     };
     if (mode == 'w'){
+        rewrite_reset_stream(file_handler_index);
+        zone_stripes[file_handler_index] = zone_stripe();
         file_handler[file_handler_index].write_buf = {
             .start_byte = 0,
             .byte_cnt = 0,
-            .content = new char[MAX_GROUP_SIZE],
+            .content = new char[write_buffer_size],
         };
     }
 }
 
+// the stored bytes of this group can't be read partially (compressed or delta encoded)
+inline bool group_is_encoded(group_addr *group){
+    return group->compress_type != COMPRESS_NONE || group->delta_depth > 0;
+}
+
+inline bool load_group(group_addr *group, char *out);
+inline void put_group(GROUP_ID_TYPE id);
+
+// rebuild the whole content of a group from its stored bytes, return false if it is corrupted
+inline bool decode_group(group_addr *group, const char *stored, char *out){
+    if (group->delta_depth > 0){
+        char base[MAX_GROUP_SIZE];
+        group_addr *delta_base = group_of(group->delta_base);
+        if (!load_group(delta_base, base)) return false;
+        return delta_decode(stored, group->stored_length, base, delta_base->group_length, out, group->group_length);
+    }
+    if (group->compress_type != COMPRESS_NONE){
+        return decompress_group(stored, group->stored_length, out, group->group_length, group->compress_type);
+    }
+    memcpy(out, stored, group->group_length);
+    return true;
+}
+
+// the backend file holding the groups of iNum (a zone file in zone storage)
+inline void group_file_path(INUM_TYPE iNum, char *full_path, size_t size){
+    if (IS_ZONE_INUM(iNum)) zone_path(iNum, full_path, size);
+    else snprintf(full_path, size, "%s%s", BACKEND, get_path(iNum).c_str());
+}
+
+// read the whole content of a group from its backend file, one pread per level of delta chain
+inline bool load_group(group_addr *group, char *out){
+    char stored[COMPRESS_BOUND(MAX_GROUP_SIZE)];
+    char full_path[1024];
+    group_file_path(group->iNum, full_path, sizeof(full_path));
+    int fh = open(full_path, O_RDONLY);
+    if (fh == -1) return false;
+    ssize_t res = pread(fh, stored, group->stored_length, group->start_byte);
+    close(fh);
+    if (res != group->stored_length) return false;
+    return decode_group(group, stored, out);
+}
+
+// find a stored group sharing a super feature, whose delta chain can still grow
+inline GROUP_ID_TYPE find_similar_group(const uint64_t sf[SF_NUM]){
+    std::shared_lock<std::shared_mutex> shared_sf_store_lock(sf_store_mutex);
+    for (int i = 0; i < SF_NUM; i++){
+        auto it = sf_store.find(sf[i]);
+        if (it != sf_store.end() && group_of(it->second)->delta_depth < delta_max_depth && group_ref(it->second) > 0) return it->second;
+    }
+    return NO_GROUP;
+}
+
+// delta encode a new unique group against a similar group or compress it into encoded (at least
+// COMPRESS_BOUND(length) bytes) if it is worth it. start_byte is set when the group is written.
+// a rewritten duplicate isn't delta encoded, its old copy would be the base and still be read.
+// the new group holds a reference of its delta base. return NO_GROUP if the group table is full
+inline GROUP_ID_TYPE encode_new_group(INUM_TYPE iNum, const char *content, uint16_t length, char *encoded, uint64_t sf[SF_NUM], bool *has_sf, bool allow_delta){
+    uint32_t encoded_length = 0;
+    uint8_t compress_type = COMPRESS_NONE;
+    GROUP_ID_TYPE delta_base = NO_GROUP;
+    *has_sf = allow_delta && delta_max_depth > 0 && sf_compute(content, length, sf);
+    if (*has_sf){
+        delta_base = find_similar_group(sf);
+        if (delta_base != NO_GROUP && !group_get_live(delta_base)) delta_base = NO_GROUP;     // died since it was found
+        char base[MAX_GROUP_SIZE];
+        if (delta_base != NO_GROUP && load_group(group_of(delta_base), base)){
+            encoded_length = delta_encode(content, length, base, group_of(delta_base)->group_length, encoded, length / DELTA_MAX_RATIO);
+        }
+        if (encoded_length == 0 && delta_base != NO_GROUP){
+            put_group(delta_base);
+            delta_base = NO_GROUP;
+        }
+    }
+    if (delta_base == NO_GROUP){
+        encoded_length = compress_group(content, length, encoded, group_compress_type, group_compress_level);
+        if (encoded_length) compress_type = group_compress_type;
+    }
+    GROUP_ID_TYPE id = group_alloc();
+    if (id == NO_GROUP){
+        if (delta_base != NO_GROUP) put_group(delta_base);
+        return NO_GROUP;
+    }
+    group_addr *new_group_addr = group_of(id);
+    new_group_addr->iNum = iNum;
+    new_group_addr->start_byte = 0;
+    new_group_addr->group_length = length;
+    new_group_addr->stored_length = encoded_length ? encoded_length : length;
+    new_group_addr->compress_type = compress_type;
+    new_group_addr->delta_base = delta_base;
+    new_group_addr->delta_depth = delta_base != NO_GROUP ? group_of(delta_base)->delta_depth + 1 : 0;
+    group_ref(id) = 1;
+    return id;
+}
+
+inline std::shared_mutex &mapping_lock_of(INUM_TYPE iNum){
+    return mapping_mutex[iNum % MAPPING_LOCK_NUM];
+}
+
+// make room for group_num more groups, growing geometrically
+inline void reserve_mapping(INUM_TYPE iNum, size_t group_num){
+    mapping_table_entry *entry = &mapping_table[iNum];
+    if (entry->group_pos.capacity() < entry->group_pos.size() + group_num){
+        entry->group_pos.reserve(std::max(entry->group_pos.size() + group_num, 2 * entry->group_pos.capacity()));
+        entry->group_offset.reserve(entry->group_pos.capacity());
+    }
+}
+
+// append a group at the end of the mapping table of iNum, a hole following a hole only lengthens it
+inline void append_mapping(INUM_TYPE iNum, GROUP_ID_TYPE group, off_t group_offset, uint64_t length){
+    mapping_table_entry *entry = &mapping_table[iNum];
+    entry->mapped_end = group_offset + length;
+    if (group_of(group)->iNum == HOLE_INUM && !entry->group_pos.empty() && group_of(entry->group_pos.back())->iNum == HOLE_INUM) return;
+    entry->group_pos.push_back(group);
+    entry->group_offset.push_back(group_offset);
+}
+
+// the length of the i-th group of a mapping table, a hole runs until the next group
+inline uint64_t extent_length(const mapping_table_entry *entry, size_t i){
+    if (group_of(entry->group_pos[i])->iNum != HOLE_INUM) return group_of(entry->group_pos[i])->group_length;
+    return (i + 1 < entry->group_pos.size() ? (uint64_t)entry->group_offset[i + 1] : entry->mapped_end) - entry->group_offset[i];
+}
+
+// the index of the group holding offset, -1 if offset is not mapped
+inline ssize_t find_extent(const mapping_table_entry *entry, off_t offset){
+    if (offset < 0 || (uint64_t)offset >= entry->mapped_end) return -1;
+    return std::upper_bound(entry->group_offset.begin(), entry->group_offset.end(), offset) - entry->group_offset.begin() - 1;
+}
+
+// the length of the next group at the front of content, a zero run of at least HOLE_MIN_LENGTH bytes becomes a hole
+inline uint32_t next_cut(const char *content, uint32_t len, bool *is_hole){
+    uint32_t zero_len = zero_prefix_length(content, len);
+    *is_hole = zero_len >= HOLE_MIN_LENGTH;
+    if (*is_hole) return zero_len;
+    return cdc_chunker.cut((const uint8_t *)content, first_zero_block(content, len), cdc_chunker.param);
+}
+
+// map [group_offset, group_offset + length) of iNum to one hole extent, no hashing and no io
+inline void commit_hole(INUM_TYPE iNum, off_t group_offset, uint64_t length){
+    DEBUG_MESSAGE("    hole: " << group_offset << " length: " << length);
+    std::unique_lock<std::shared_mutex> unique_status_record_lock(status_record_mutex);
+    total_write_size += length;
+    total_dedup_size += length;
+    unique_status_record_lock.unlock();
+    if (length > 0) append_mapping(iNum, get_hole_group(), group_offset, length);
+}
+
+// a chunk cut from the write buffer
+struct pending_chunk{
+    uint32_t pos;           // offset in the write buffer
+    uint32_t length;
+    bool is_hole;
+    GROUP_ID_TYPE group;    // the duplicate or newly stored group
+};
+
+// run fn(t) for every t < thread_num, the calling thread takes t = 0
+template <typename F>
+inline void run_parallel(unsigned thread_num, F fn){
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < thread_num; t++) threads.emplace_back(fn, t);
+    fn(0);
+    for (std::thread &thread : threads) thread.join();
+}
+
+// cut content from pos until a chunk starts at or after stop. A chunk is only cut while MAX_GROUP_SIZE bytes
+// follow it, so cut points don't depend on how the host splits its writes, unless the buffer is flushed.
+// return where the next chunk would start
+inline uint32_t cut_range(const char *content, uint32_t len, bool flush, uint32_t pos, uint32_t stop, std::vector<pending_chunk> &chunks){
+    while (pos < stop && pos < len && (flush || len - pos >= MAX_GROUP_SIZE)){
+        bool is_hole;
+        uint32_t cut_pos = next_cut(content + pos, std::min(len - pos, (uint32_t)MAX_GROUP_SIZE), &is_hole);
+        DEBUG_MESSAGE("    cut pos: " << pos + cut_pos);
+        chunks.push_back({pos, cut_pos, is_hole, NO_GROUP});
+        pos += cut_pos;
+    }
+    return pos;
+}
+
+// cut content into chunks, return the bytes cut.
+// With several threads the buffer is split into segments and every segment is cut speculatively from its first
+// byte. The real chunk chain is then walked serially: once it reaches a cut point of the speculative chain of a
+// segment both chains are the same, since a cut only depends on the bytes after it. So the result is exactly the
+// serial one, and only the few chunks before they meet are cut again.
+inline uint32_t cut_write_buffer(const char *content, uint32_t len, bool flush, std::vector<pending_chunk> &chunks){
+    unsigned segment_num = std::min(chunk_threads, std::max(len / PARALLEL_CHUNK_SEGMENT, 1U));
+    if (segment_num == 1) return cut_range(content, len, flush, 0, len, chunks);
+    std::vector<uint32_t> bound(segment_num + 1);
+    for (unsigned t = 0; t <= segment_num; t++){
+        bound[t] = t == segment_num ? len : (uint64_t)len * t / segment_num / BLOCK_SIZE * BLOCK_SIZE;  // aligned, so fixed size chains meet at once
+    }
+    std::vector<std::vector<pending_chunk>> speculative(segment_num);
+    std::vector<uint32_t> speculative_end(segment_num);
+    run_parallel(segment_num, [&](unsigned t){
+        speculative_end[t] = cut_range(content, len, flush, bound[t], bound[t + 1], speculative[t]);
+    });
+    chunks = std::move(speculative[0]);
+    uint32_t pos = speculative_end[0];
+    for (unsigned t = 1; t < segment_num; t++){
+        const std::vector<pending_chunk> &spec = speculative[t];
+        size_t k = 0;
+        while (pos < bound[t + 1]){
+            while (k < spec.size() && spec[k].pos < pos) k++;
+            if (k < spec.size() && spec[k].pos == pos){     // met the speculative chain, adopt the rest of it
+                chunks.insert(chunks.end(), spec.begin() + k, spec.end());
+                pos = speculative_end[t];
+                break;
+            }
+            uint32_t next = cut_range(content, len, flush, pos, pos + 1, chunks);
+            if (next == pos) return pos;    // less than MAX_GROUP_SIZE left
+            pos = next;
+        }
+    }
+    return pos;
+}
+
+// fingerprint a batch of chunks, dedup them with one index pass, store the unique ones with pwritev and map
+// them in order at start_byte of the file. return 0 or -errno
+inline int commit_batch(FILE_HANDLER_INDEX_TYPE file_handler_index, const char *content, off_t start_byte, std::vector<pending_chunk> &chunks){
+    INUM_TYPE iNum = file_handler[file_handler_index].iNum;
+    uint64_t write_size = 0, dedup_size = 0;
+    std::shared_lock<std::shared_mutex> shared_journal_checkpoint_lock(journal_checkpoint_mutex);  // no checkpoint sees half a batch
+    // hashing, large batches are split between chunk_threads threads
+    std::vector<pending_chunk *> data;
+    for (pending_chunk &chunk : chunks){
+        if (chunk.is_hole) continue;
+        data.push_back(&chunk);
+        write_size += chunk.length;
+    }
+    std::vector<FP_TYPE> fps(data.size());
+    unsigned hash_threads = std::min(chunk_threads, std::max((unsigned)(write_size / PARALLEL_CHUNK_SEGMENT), 1U));
+    run_parallel(hash_threads, [&](unsigned t){
+        for (size_t i = data.size() * t / hash_threads; i < data.size() * (t + 1) / hash_threads; i++){
+            char cur_fp[SHA_DIGEST_LENGTH];
+            SHA1((const unsigned char *)content + data[i]->pos, data[i]->length, (unsigned char *)cur_fp);
+            fps[i].assign(cur_fp, SHA_DIGEST_LENGTH);
+        }
+    });
+    // zones can't be reclaimed from the lookup until the duplicates hold their references, nor while delta bases are
+    // read and the new groups aren't on disk yet
+    std::shared_lock<std::shared_mutex> shared_zone_reclaim_lock(zone_reclaim_mutex, std::defer_lock);
+    if (storage_mode == STORAGE_ZONE) shared_zone_reclaim_lock.lock();
+    // query the index once for the whole batch, repeats inside the batch point to their first copy
+    std::vector<GROUP_ID_TYPE> found(data.size(), NO_GROUP);
+    std::vector<size_t> new_idx, copy_of(data.size(), SIZE_MAX);
+    std::vector<bool> rewritten(data.size(), false);
+    std::vector<GROUP_ID_TYPE> held;    // references taken on found duplicates
+    #ifndef NODEDUPE
+    fp_index_lookup_batch(file_handler_index, fps.data(), data.size(), found.data());
+    if (rewrite_cap > 0){   // duplicates scattering the file over too many containers are stored again
+        std::vector<uint32_t> lengths;
+        for (pending_chunk *chunk : data) lengths.push_back(chunk->length);
+        std::shared_lock<std::shared_mutex> shared_status_record_lock(status_record_mutex);
+        uint64_t written = total_write_size + write_size;
+        shared_status_record_lock.unlock();
+        rewrite_select(file_handler_index, iNum, found.data(), lengths.data(), data.size(), written, rewritten);
+    }
+    // take the references of the duplicates at once, a group unlinked since the lookup is stored again
+    for (size_t i = 0; i < data.size(); i++){
+        if (found[i] == NO_GROUP) continue;
+        if (group_get_live(found[i])) held.push_back(found[i]);
+        else found[i] = NO_GROUP;
+    }
+    std::unordered_map<FP_TYPE, size_t> first_copy;
+    #endif
+    for (size_t i = 0; i < data.size(); i++){
+        if (found[i] != NO_GROUP) continue;
+        #ifndef NODEDUPE
+        auto it = first_copy.find(fps[i]);
+        if (it != first_copy.end()){
+            copy_of[i] = it->second;
+            continue;
+        }
+        first_copy[fps[i]] = i;
+        #endif
+        new_idx.push_back(i);
+    }
+    // encode the unique groups, then write them back to back at the end of the backend file or append them into zones
+    bool may_encode = group_compress_type != COMPRESS_NONE || delta_max_depth > 0;
+    std::vector<char> encoded(may_encode ? new_idx.size() * COMPRESS_BOUND(MAX_GROUP_SIZE) : 0);
+    std::vector<uint64_t> sf(new_idx.size() * SF_NUM);
+    std::vector<bool> has_sf(new_idx.size());
+    std::vector<GROUP_ID_TYPE> new_groups;
+    std::vector<struct iovec> iov;
+    uint64_t stored_size = 0;
+    int res = 0;
+    for (size_t n = 0; n < new_idx.size(); n++){
+        pending_chunk *chunk = data[new_idx[n]];
+        char *out = may_encode ? encoded.data() + n * COMPRESS_BOUND(MAX_GROUP_SIZE) : NULL;
+        bool sf_valid;
+        GROUP_ID_TYPE id = encode_new_group(iNum, content + chunk->pos, chunk->length, out, &sf[n * SF_NUM], &sf_valid, !rewritten[new_idx[n]]);
+        if (id == NO_GROUP){
+            res = -ENOSPC;
+            break;
+        }
+        group_addr *group = group_of(id);
+        has_sf[n] = sf_valid;
+        group->start_byte = mapping_table[iNum].actual_size_in_disk + stored_size;
+        stored_size += group->stored_length;
+        iov.push_back({group_is_encoded(group) ? out : (char *)content + chunk->pos, group->stored_length});
+        new_groups.push_back(id);
+        found[new_idx[n]] = id;
+    }
+    if (res == 0 && storage_mode == STORAGE_ZONE) {
+        res = zone_write_groups(new_groups.data(), iov.data(), iov.size(), &zone_stripes[file_handler_index], shared_zone_reclaim_lock);
+    }
+    else if (res == 0 && !pwritev_all(file_handler[file_handler_index].fh, iov.data(), iov.size(), mapping_table[iNum].actual_size_in_disk)){
+        res = errno ? -errno : -EIO;
+    }
+    else if (res == 0) journal_mark_data(file_handler[file_handler_index].fh);
+    if (res != 0){
+        PRINT_WARNING("write back to disk failed!!");
+        for (GROUP_ID_TYPE id : new_groups){
+            if (group_of(id)->delta_base != NO_GROUP) put_group(group_of(id)->delta_base);
+            if (IS_ZONE_INUM(group_of(id)->iNum)){  // zones still list it, leave it dead for reclaim
+                group_ref(id) = 0;
+                zone_release(group_of(id));
+            }
+            else group_free(id);
+        }
+        for (GROUP_ID_TYPE id : held) put_group(id);
+        return res;
+    }
+    mapping_table[iNum].actual_size_in_disk += stored_size;
+    std::vector<FP_TYPE> new_fps;
+    for (size_t n = 0; n < new_idx.size(); n++) new_fps.push_back(fps[new_idx[n]]);
+    journal_log_groups(new_groups.data(), new_fps.data(), new_groups.size());  // before anyone can dedup against them
+    // account the new groups: delta bases, super features and savings
+    uint64_t compress_saving = 0, delta_saving = 0;
+    for (size_t n = 0; n < new_groups.size(); n++){
+        group_addr *group = group_of(new_groups[n]);
+        if (group->delta_base != NO_GROUP){     // the base lives as long as its delta, encode_new_group took its reference
+            delta_saving += group->group_length - group->stored_length;
+        }
+        else if (group->compress_type != COMPRESS_NONE) compress_saving += group->group_length - group->stored_length;
+        if (has_sf[n] && group->delta_depth < delta_max_depth){
+            std::unique_lock<std::shared_mutex> unique_sf_store_lock(sf_store_mutex);
+            for (int i = 0; i < SF_NUM; i++) sf_store[sf[n * SF_NUM + i]] = new_groups[n];
+        }
+    }
+    if (shared_zone_reclaim_lock.owns_lock()) shared_zone_reclaim_lock.unlock();
+    std::unique_lock<std::shared_mutex> unique_status_record_lock(status_record_mutex);
+    total_compress_saving += compress_saving;
+    total_delta_saving += delta_saving;
+    unique_status_record_lock.unlock();
+    // duplicates
+    for (size_t n = 0; n < new_idx.size(); n++) copy_of[new_idx[n]] = new_idx[n];
+    for (size_t i = 0; i < data.size(); i++){
+        if (copy_of[i] == i) data[i]->group = found[i];
+        else{
+            DEBUG_MESSAGE("    found duplicate group!!");
+            data[i]->group = copy_of[i] != SIZE_MAX ? found[copy_of[i]] : found[i];
+            if (copy_of[i] != SIZE_MAX) group_ref(data[i]->group)++;    // a copy of a new group, found ones hold theirs already
+            dedup_size += data[i]->length;
+        }
+    }
+    fp_index_insert_batch(file_handler_index, new_fps.data(), new_fps.size(), new_groups.data());
+    // mapping, in file order
+    std::unique_lock<std::shared_mutex> unique_mapping_lock(mapping_lock_of(iNum));
+    if (!chunks.empty()) reserve_mapping(iNum, chunks.size());
+    for (pending_chunk &chunk : chunks){
+        if (chunk.is_hole) commit_hole(iNum, start_byte + chunk.pos, chunk.length);
+        else append_mapping(iNum, chunk.group, start_byte + chunk.pos, chunk.length);
+    }
+    unique_mapping_lock.unlock();
+    if (journal_enabled){
+        std::vector<journal_extent> extents;
+        for (pending_chunk &chunk : chunks) extents.push_back({start_byte + chunk.pos, chunk.length, chunk.is_hole ? NO_GROUP : chunk.group});
+        journal_log_extents(iNum, extents.data(), extents.size());
+    }
+    unique_status_record_lock.lock();
+    total_write_size += write_size;
+    total_dedup_size += dedup_size;
+    unique_status_record_lock.unlock();
+    return 0;
+}
+
+// cut and commit the write buffer of a handler, keeping the tail that may still grow unless flush is set
+inline int commit_write_buffer(FILE_HANDLER_INDEX_TYPE file_handler_index, bool flush){
+    buffer_entry *file_buffer = &file_handler[file_handler_index].write_buf;
+    if (file_buffer->byte_cnt == 0) return 0;
+    DEBUG_MESSAGE("  start write back file buffer");
+    std::vector<pending_chunk> chunks;
+    uint32_t cut_len = cut_write_buffer(file_buffer->content, file_buffer->byte_cnt, flush, chunks);
+    int res = commit_batch(file_handler_index, file_buffer->content, file_buffer->start_byte, chunks);
+    if (res != 0) return res;
+    memmove(file_buffer->content, file_buffer->content + cut_len, file_buffer->byte_cnt - cut_len);
+    file_buffer->start_byte += cut_len;
+    file_buffer->byte_cnt -= cut_len;
+    return 0;
+}
+
+// chunk and commit everything staged in the write buffer, used when no more data will follow it
+inline int flush_write_buffer(FILE_HANDLER_INDEX_TYPE file_handler_index){
+    return commit_write_buffer(file_handler_index, true);
+}
+
+// extend the file of this handler to new_size with a hole (sparse write / ftruncate), staged data is flushed first
+inline int extend_with_hole(FILE_HANDLER_INDEX_TYPE file_handler_index, off_t new_size){
+    INUM_TYPE iNum = file_handler[file_handler_index].iNum;
+    off_t old_size = mapping_table[iNum].logical_size_for_host;
+    if (new_size <= old_size) return 0;
+    int res = flush_write_buffer(file_handler_index);
+    if (res != 0) return res;
+    std::shared_lock<std::shared_mutex> shared_journal_checkpoint_lock(journal_checkpoint_mutex);
+    std::unique_lock<std::shared_mutex> unique_mapping_lock(mapping_lock_of(iNum));
+    commit_hole(iNum, old_size, new_size - old_size);
+    unique_mapping_lock.unlock();
+    journal_extent hole = {old_size, (uint64_t)(new_size - old_size), NO_GROUP};
+    journal_log_extents(iNum, &hole, 1);
+    mapping_table[iNum].logical_size_for_host = new_size;
+    file_handler[file_handler_index].write_buf.start_byte = new_size;
+    return 0;
+}
+
 static int cdcfs_getattr(const char *path, struct stat *stbuf) {
     int res;
     char full_path[1024];
@@ -124,6 +574,7 @@ static int cdcfs_create(const char *path, mode_t mode, struct fuse_file_info *fi
     
     real_file_handler = creat(full_path, mode);
     if (real_file_handler == -1) return -errno;
+    journal_mark_dir(std::filesystem::path(full_path).parent_path());
     fi->fh = get_free_file_handler();
     if (fi->fh == (FILE_HANDLER_INDEX_TYPE)-1) return -errno;
 
@@ -148,114 +599,278 @@ static int cdcfs_open(const char *path, struct fuse_file_info *fi) {
     return 0;
 }
 
+inline int journal_checkpoint();
+inline size_t group_sweep();
+
 static int cdcfs_release(const char *path, struct fuse_file_info *fi) {
     int res;
     DEBUG_MESSAGE("[release]" << path);
 
-    INUM_TYPE iNum = file_handler[fi->fh].iNum;
     buffer_entry *file_buffer = &file_handler[fi->fh].write_buf;
 
     // write back file buffer
-    int write_back_ptr = 0;
-    while (write_back_ptr < file_buffer->byte_cnt){
-        DEBUG_MESSAGE("  start write back file buffer");
-        // not implement content chunking yet, use fixed sized
-        //int cut_pos = std::min(file_buffer->byte_cnt, (uint16_t)4096);
-        //int cut_pos = file_buffer->byte_cnt;
-        int cut_pos = cut((const uint8_t*)file_buffer->content + write_back_ptr, file_buffer->byte_cnt - write_back_ptr, ctx->mi, ctx->ma, ctx->ns,
-                      ctx->mask_s, ctx->mask_l);
-
-        #ifdef CAFTL
-        cut_pos = std::min(file_buffer->byte_cnt, (uint16_t)BLOCK_SIZE); // use fixed chunking
-        #endif
-        DEBUG_MESSAGE("    cut pos: " << cut_pos << " actual_size_in_disk: " << mapping_table[iNum].actual_size_in_disk);
+    res = flush_write_buffer(fi->fh);
+    if (res != 0) return res;
+    fp_index_close_stream(fi->fh);
+    if (journal_want_checkpoint()) journal_checkpoint();
+    if (group_want_sweep()) group_sweep();
+    if (file_buffer->content != NULL){
+        delete[] file_buffer->content;
+        file_buffer->content = NULL;
+    }
 
-        std::unique_lock<std::shared_mutex> unique_status_record_lock(status_record_mutex);
-        total_write_size += cut_pos;
-        unique_status_record_lock.unlock();
-
-        char cur_fp[SHA_DIGEST_LENGTH];
-        SHA1((const unsigned char *)file_buffer->content + write_back_ptr, cut_pos, (unsigned char *)cur_fp);
-        FP_TYPE new_fp(cur_fp, SHA_DIGEST_LENGTH);
-
-        #ifdef NODEDUPE
-            group_addr *new_group_addr = new group_addr;
-            new_group_addr->iNum = iNum;
-            new_group_addr->ref_times = 1;
-            new_group_addr->start_byte = mapping_table[iNum].actual_size_in_disk;
-            new_group_addr->group_length = cut_pos;
-            int res = pwrite(file_handler[fi->fh].fh, file_buffer->content + write_back_ptr, cut_pos, mapping_table[iNum].actual_size_in_disk);
-            if (res == -1){
-                PRINT_WARNING("write back to disk failed!!");
-                delete new_group_addr;
-                return -errno;
-            }
-            int blk_count = std::ceil((float)cut_pos / BLOCK_SIZE);
-            mapping_table[iNum].actual_size_in_disk += cut_pos;
-            mapping_table[iNum].group_pos.push_back(new_group_addr);
-            mapping_table[iNum].group_offset.push_back(file_buffer->start_byte + write_back_ptr);
-            for(int i = 0; i < blk_count; i++){
-                mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
+    res = journal_close_data(file_handler[fi->fh].fh);
+    if (res == -1) {
+        return -errno;
+    }
+    release_file_handler(fi->fh);
+    return 0;
+}
+
+// drop one reference of a group, a group nobody references is garbage (and so is one reference of its delta base)
+inline void put_group(GROUP_ID_TYPE id){
+    if (!group_drop(id)) return;
+    zone_release(group_of(id));
+    if (group_of(id)->delta_base != NO_GROUP) put_group(group_of(id)->delta_base);
+}
+
+// recycle the slots of the tombstones (dead groups reclaimed from their zone): their handles are dropped from the
+// fingerprint index, sf_store and the journal first. return the slots recycled
+inline size_t group_sweep(){
+    std::unique_lock<std::shared_mutex> unique_journal_checkpoint_lock(journal_checkpoint_mutex);  // no batch holds a looked up handle
+    std::unique_lock<std::mutex> group_table_lock(group_table_mutex);
+    std::vector<GROUP_ID_TYPE> dead_ids;
+    dead_ids.swap(group_tombstones);
+    std::vector<bool> dead(group_next, false);
+    group_table_lock.unlock();
+    if (dead_ids.empty()) return 0;
+    for (GROUP_ID_TYPE id : dead_ids) dead[id] = true;
+    fp_index_forget(dead);
+    journal_forget_groups(dead);
+    std::unique_lock<std::shared_mutex> unique_sf_store_lock(sf_store_mutex);
+    for (auto it = sf_store.begin(); it != sf_store.end(); ){
+        if (dead[it->second]) it = sf_store.erase(it);
+        else ++it;
+    }
+    unique_sf_store_lock.unlock();
+    group_table_lock.lock();
+    for (GROUP_ID_TYPE id : dead_ids) group_gen(id)++;
+    group_free_ids.insert(group_free_ids.end(), dead_ids.begin(), dead_ids.end());
+    return dead_ids.size();
+}
+
+static int cdcfs_unlink(const char *path) {
+    int res;
+    char full_path[1024];
+    snprintf(full_path, sizeof(full_path), "%s%s", BACKEND, path);
+    DEBUG_MESSAGE("[unlink]" << path);
+
+    if (storage_mode != STORAGE_ZONE) return -EPERM;     // other files dedup against the groups in its backend file
+    res = unlink(full_path);
+    if (res == -1) {
+        return -errno;
+    }
+    std::shared_lock<std::shared_mutex> shared_journal_checkpoint_lock(journal_checkpoint_mutex);
+    std::unique_lock<std::shared_mutex> unique_create_file_lock(create_file_mutex);
+    auto it = path_to_iNum.find(PATH_TYPE(path));
+    if (it == path_to_iNum.end()) return 0;
+    INUM_TYPE iNum = it->second;
+    journal_log_unlink(iNum);
+    path_to_iNum.erase(it);
+    iNum_to_path[iNum].clear();
+    free_iNum.insert(iNum);
+    std::unique_lock<std::shared_mutex> unique_mapping_lock(mapping_lock_of(iNum));    // before the iNum can be reused
+    unique_create_file_lock.unlock();
+    // the groups of this file are in zones, so the iNum can be reused at once
+    for (GROUP_ID_TYPE group : mapping_table[iNum].group_pos){
+        if (group_of(group)->iNum != HOLE_INUM) put_group(group);
+    }
+    mapping_table[iNum] = mapping_table_entry();
+    return 0;
+}
+
+// flush the staged data of this handler, then make data and metadata durable with one group commit shared by every
+// concurrent fsync. without journal only the data is synced, the metadata only lives in memory
+static int cdcfs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    int res = 0;
+    DEBUG_MESSAGE("[fsync]" << path << " datasync: " << datasync);
+
+    if (file_handler[fi->fh].mode == 'w') res = flush_write_buffer(fi->fh);
+    if (res != 0) return res;
+    if (journal_enabled) res = journal_commit();
+    else if (storage_mode == STORAGE_ZONE) res = journal_sync_data();
+    else if (fdatasync(file_handler[fi->fh].fh) == -1) res = -errno;
+    if (res == 0 && journal_want_checkpoint()) journal_checkpoint();
+    if (group_want_sweep()) group_sweep();
+    return res;
+}
+
+// take one reference of a group while replaying the journal, a group coming alive again holds its delta base and
+// its bytes are live again (see put_group)
+inline void get_group(GROUP_ID_TYPE id){
+    if (group_ref(id)++ > 0) return;
+    zone_retain(group_of(id));
+    if (group_of(id)->delta_base != NO_GROUP) get_group(group_of(id)->delta_base);
+}
+
+// apply one journal record to the metadata
+inline void journal_apply(uint8_t type, const char *payload, uint16_t length){
+    switch (type){
+        case JOURNAL_FILE:
+        case JOURNAL_UNLINK: {
+            journal_file_record record;
+            if (length < sizeof(record)) return;
+            memcpy(&record, payload, sizeof(record));
+            INUM_TYPE iNum = record.iNum;
+            if (iNum >= MAX_INODE_NUM - 1) return;
+            if (!iNum_to_path[iNum].empty()) path_to_iNum.erase(iNum_to_path[iNum]);
+            if (type == JOURNAL_FILE){
+                PATH_TYPE path(payload + sizeof(record), length - sizeof(record));
+                path_to_iNum[path] = iNum;
+                iNum_to_path[iNum] = path;
+                free_iNum.erase(iNum);
+                return;
             }
-            std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
-            fp_store[new_fp] = new_group_addr;
-            unique_fp_store_lock.unlock();
-        #endif
-        #ifndef NODEDUPE
-        std::unique_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
-        auto fp_store_iter = fp_store.find(new_fp);
-        shared_fp_store_lock.unlock();
-        if (fp_store_iter != fp_store.end()){   // found
-            DEBUG_MESSAGE("    found duplicate group!!");
-            unique_status_record_lock.lock();
-            total_dedup_size += cut_pos;
-            unique_status_record_lock.unlock();
-            mapping_table[iNum].group_pos.push_back(fp_store_iter->second);
-            fp_store_iter->second->ref_times += 1;
-            mapping_table[iNum].group_offset.push_back(file_buffer->start_byte + write_back_ptr);
-            int blk_count = std::ceil((float)cut_pos / BLOCK_SIZE);
-            for(int i = 0; i < blk_count; i++){
-                mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
+            iNum_to_path[iNum].clear();
+            free_iNum.insert(iNum);
+            for (GROUP_ID_TYPE group : mapping_table[iNum].group_pos){
+                if (group_of(group)->iNum != HOLE_INUM) put_group(group);
             }
+            mapping_table[iNum] = mapping_table_entry();
+            return;
         }
-        else{                                   // not found
-            group_addr *new_group_addr = new group_addr;
-            new_group_addr->iNum = iNum;
-            new_group_addr->ref_times = 1;
-            new_group_addr->start_byte = mapping_table[iNum].actual_size_in_disk;
-            new_group_addr->group_length = cut_pos;
-            int res = pwrite(file_handler[fi->fh].fh, file_buffer->content + write_back_ptr, cut_pos, mapping_table[iNum].actual_size_in_disk);
-            if (res == -1){
-                PRINT_WARNING("write back to disk failed!!");
-                delete new_group_addr;
-                return -errno;
+        case JOURNAL_GROUP: {
+            journal_group_record record;
+            if (length != sizeof(record)) return;
+            memcpy(&record, payload, sizeof(record));
+            GROUP_ID_TYPE id = group_alloc();     // references come with the mappings
+            if (id == NO_GROUP) return;
+            group_addr *group = group_of(id);
+            group->iNum = record.iNum;
+            group->start_byte = record.start_byte;
+            group->group_length = record.group_length;
+            group->stored_length = record.stored_length;
+            group->compress_type = record.compress_type;
+            group->delta_base = record.base_id < journal_groups.size() ? journal_groups[record.base_id].group : NO_GROUP;
+            group->delta_depth = group->delta_base != NO_GROUP ? group_of(group->delta_base)->delta_depth + 1 : 0;
+            if (journal_groups.size() <= record.id) journal_groups.resize(record.id + 1, {NO_GROUP, {}});
+            journal_groups[record.id].group = id;
+            memcpy(journal_groups[record.id].fp, record.fp, SHA_DIGEST_LENGTH);
+            journal_group_ids[id] = record.id;
+            if (IS_ZONE_INUM(group->iNum)){
+                if (storage_mode == STORAGE_ZONE && group->iNum - ZONE_INUM(0) < zones.size()) zone_recover_group(id);
+                else group->iNum = FREED_INUM;  // mounted without its zone
             }
-            int blk_count = std::ceil((float)cut_pos / BLOCK_SIZE);
-            mapping_table[iNum].actual_size_in_disk += cut_pos;
-            mapping_table[iNum].group_pos.push_back(new_group_addr);
-            mapping_table[iNum].group_offset.push_back(file_buffer->start_byte + write_back_ptr);
-            for(int i = 0; i < blk_count; i++){
-                mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
+            else if (group->iNum < MAX_INODE_NUM){
+                mapping_table_entry *owner = &mapping_table[group->iNum];
+                owner->actual_size_in_disk = std::max(owner->actual_size_in_disk, (unsigned long)group->start_byte + group->stored_length);
             }
-            std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
-            fp_store[new_fp] = new_group_addr;
-            unique_fp_store_lock.unlock();
+            if (group->delta_base != NO_GROUP) total_delta_saving += group->group_length - group->stored_length;
+            else if (group->compress_type != COMPRESS_NONE) total_compress_saving += group->group_length - group->stored_length;
+            fp_index_insert(0, FP_TYPE(record.fp, SHA_DIGEST_LENGTH), id);
+            return;
         }
-        #endif
+        case JOURNAL_MAP: {
+            journal_map_record record;
+            if (length != sizeof(record)) return;
+            memcpy(&record, payload, sizeof(record));
+            if (record.iNum >= MAX_INODE_NUM - 1) return;
+            mapping_table_entry *entry = &mapping_table[record.iNum];
+            reserve_mapping(record.iNum, 1);
+            if (record.id == JOURNAL_NO_ID) commit_hole(record.iNum, record.offset, record.length);
+            else if (record.id < journal_groups.size() && journal_groups[record.id].group != NO_GROUP){
+                GROUP_ID_TYPE group = journal_groups[record.id].group;
+                total_write_size += record.length;
+                if (group_ref(group) > 0) total_dedup_size += record.length;
+                get_group(group);
+                append_mapping(record.iNum, group, record.offset, record.length);
+            }
+            entry->logical_size_for_host = std::max(entry->logical_size_for_host, (unsigned long)(record.offset + record.length));
+            return;
+        }
+        case JOURNAL_MOVE: {
+            journal_move_record record;
+            if (length != sizeof(record)) return;
+            memcpy(&record, payload, sizeof(record));
+            if (record.id >= journal_groups.size() || journal_groups[record.id].group == NO_GROUP) return;
+            GROUP_ID_TYPE id = journal_groups[record.id].group;
+            group_addr *group = group_of(id);
+            group->iNum = record.iNum;
+            group->start_byte = record.start_byte;
+            if (storage_mode == STORAGE_ZONE && IS_ZONE_INUM(group->iNum) && group->iNum - ZONE_INUM(0) < zones.size()) zone_recover_group(id);
+            return;
+        }
+        case JOURNAL_ZONE: {
+            journal_zone_record record;
+            if (length != sizeof(record)) return;
+            memcpy(&record, payload, sizeof(record));
+            zone_recover_wp(record.zone, record.wp);
+            return;
+        }
+    }
+}
 
-        write_back_ptr += cut_pos;
+// write the whole metadata into a new checkpoint and empty the journal, return 0 or -errno
+inline int journal_checkpoint(){
+    if (!journal_enabled) return 0;
+    std::unique_lock<std::shared_mutex> unique_journal_checkpoint_lock(journal_checkpoint_mutex);  // no metadata update in flight
+    std::shared_lock<std::shared_mutex> shared_create_file_lock(create_file_mutex);
+    std::string records;
+    for (size_t z = 0; z < zones.size(); z++){
+        if (zones[z].wp == 0) continue;
+        journal_zone_record record = {(uint32_t)z, zones[z].wp};
+        journal_put(records, JOURNAL_ZONE, &record, sizeof(record));
     }
-    if (file_buffer->content != NULL){
-        free(file_buffer->content);
-        file_buffer->content = NULL;
+    // live groups in their old order, so delta bases come first. ids are renumbered densely
+    std::vector<journal_group_entry> entries;
+    std::unordered_map<GROUP_ID_TYPE, uint32_t> ids;
+    for (const journal_group_entry &entry : journal_groups){
+        if (entry.group == NO_GROUP || group_ref(entry.group) == 0) continue;
+        auto base_it = ids.find(group_of(entry.group)->delta_base);
+        journal_group_record record = journal_group_of(group_of(entry.group), entries.size(), base_it == ids.end() ? JOURNAL_NO_ID : base_it->second, entry.fp);
+        journal_put(records, JOURNAL_GROUP, &record, sizeof(record));
+        ids[entry.group] = entries.size();
+        entries.push_back(entry);
+    }
+    for (const auto &[path, iNum] : path_to_iNum){
+        journal_put_file(records, iNum, path);
+        mapping_table_entry *entry = &mapping_table[iNum];
+        for (size_t i = 0; i < entry->group_pos.size(); i++){
+            group_addr *group = group_of(entry->group_pos[i]);
+            journal_map_record record = {(uint32_t)iNum, JOURNAL_NO_ID, (uint64_t)entry->group_offset[i], extent_length(entry, i)};
+            if (group->iNum != HOLE_INUM){
+                auto it = ids.find(entry->group_pos[i]);
+                if (it == ids.end()) continue;
+                record.id = it->second;
+            }
+            journal_put(records, JOURNAL_MAP, &record, sizeof(record));
+        }
     }
+    return journal_write_checkpoint(records, entries);
+}
 
-    res = close(file_handler[fi->fh].fh);
-    if (res == -1) {
-        return -errno;
+// rebuild the metadata from the checkpoint and the journal ("-o recover") and checkpoint it, so the next
+// recovery starts from here. return the records replayed
+inline uint64_t journal_recover(){
+    uint64_t records = 0;
+    auto apply = [&](uint8_t type, const char *payload, uint16_t length){
+        journal_apply(type, payload, length);
+        records++;
+    };
+    journal_read("checkpoint", apply);
+    journal_file_size = journal_read("journal", apply);
+    if (ftruncate(journal_fh, journal_file_size) == -1) PRINT_WARNING("can't drop the torn tail of the journal");
+    // a file whose backend file is gone was unlinked after the last commit
+    std::vector<journal_file_record> unlinked;
+    for (const auto &[path, iNum] : path_to_iNum){
+        std::error_code ec;
+        if (!std::filesystem::exists(std::string(BACKEND) + path, ec)) unlinked.push_back({(uint32_t)iNum});
     }
-    release_file_handler(fi->fh);
-    return 0;
+    for (journal_file_record &record : unlinked) journal_apply(JOURNAL_UNLINK, (const char *)&record, sizeof(record));
+    zone_recover_finish();
+    fp_index_close_stream(0);
+    journal_checkpoint();
+    return records;
 }
 
 static int cdcfs_utime(const char *path, struct utimbuf *ubuf) {
@@ -288,43 +903,31 @@ static int cdcfs_read(const char *path, char *buf, size_t size, off_t offset, st
 
     // find first block group index
     INUM_TYPE iNum = file_handler[fi->fh].iNum;
+    std::shared_lock<std::shared_mutex> shared_zone_reclaim_lock(zone_reclaim_mutex, std::defer_lock);
+    if (storage_mode == STORAGE_ZONE) shared_zone_reclaim_lock.lock();     // groups must not move while being read
+    std::shared_lock<std::shared_mutex> shared_mapping_lock(mapping_lock_of(iNum));    // another handler may append
     #ifdef READ_REQ_OUTPUT_PATH
-        rd_req[rd_req_count++] = {iNum, offset, size};
+        if (rd_req_count < MAX_REC_RD_REQ) rd_req[rd_req_count++] = {iNum, offset, size};
     #endif
-    uint32_t blk_num = offset / BLOCK_SIZE;
-    unsigned long start_group_idx;
-    if (blk_num < mapping_table[iNum].group_idx.size() && (uint32_t)mapping_table[iNum].group_idx[blk_num] < mapping_table[iNum].group_pos.size()){
-        start_group_idx = mapping_table[iNum].group_idx[blk_num];
-    }
-    else{
-        start_group_idx = mapping_table[iNum].group_pos.size()-1;
-    }
-    if (mapping_table[iNum].group_pos.size() == 0 || size == 0) return 0;
-
-    while (true) {
-        off_t cur_group_offset = mapping_table[iNum].group_offset[start_group_idx];
-        if (cur_group_offset > offset)
-            start_group_idx--;
-        else if(cur_group_offset + mapping_table[iNum].group_pos[start_group_idx]->group_length <= offset)
-            start_group_idx++;
-        else break;
-        if (start_group_idx < 0 || start_group_idx >= mapping_table[iNum].group_pos.size()) return 0;
-    }
+    ssize_t found_group_idx = find_extent(&mapping_table[iNum], offset);
+    if (found_group_idx < 0 || size == 0) return 0;
+    unsigned long start_group_idx = found_group_idx;
     DEBUG_MESSAGE("  start block: " << start_group_idx);
     
     // seperate each block group by iNum
     std::map<INUM_TYPE, std::vector<group_addr *>> group_idx_of_inode;
-    int less = size + (offset - mapping_table[iNum].group_offset[start_group_idx]);
+    int64_t less = size + (offset - mapping_table[iNum].group_offset[start_group_idx]);
     unsigned long cur_group_idx = start_group_idx;
     while(less > 0 && cur_group_idx < mapping_table[iNum].group_pos.size()) {
-        group_addr *cur_group = mapping_table[iNum].group_pos[cur_group_idx];
+        group_addr *cur_group = group_of(mapping_table[iNum].group_pos[cur_group_idx]);
         INUM_TYPE cur_iNum = cur_group->iNum;
+        less -= extent_length(&mapping_table[iNum], cur_group_idx);
+        cur_group_idx++;
+        if (cur_iNum == HOLE_INUM) continue;     // holes need no io
         if (group_idx_of_inode.find(cur_iNum) == group_idx_of_inode.end()){
             group_idx_of_inode[cur_iNum] = std::vector<group_addr *>();
         }
         group_idx_of_inode[cur_iNum].push_back(cur_group);
-        less -= cur_group->group_length;
-        cur_group_idx++;
     }
     unsigned long end_group_idx = cur_group_idx;
 
@@ -333,7 +936,8 @@ static int cdcfs_read(const char *path, char *buf, size_t size, off_t offset, st
     // analyze need to read block group part
     std::map<group_addr *, interval> inter_group_interval;
     for (cur_group_idx = start_group_idx; cur_group_idx < end_group_idx; cur_group_idx++) {
-        group_addr *cur_group = mapping_table[iNum].group_pos[cur_group_idx];
+        group_addr *cur_group = group_of(mapping_table[iNum].group_pos[cur_group_idx]);
+        if (cur_group->iNum == HOLE_INUM) continue;
         off_t cur_group_offset = mapping_table[iNum].group_offset[cur_group_idx];
         off_t inter_group_start = cur_group_offset > offset ? 0 : offset - cur_group_offset;
         off_t inter_group_end = cur_group_offset + (size_t)cur_group->group_length < offset + size 
@@ -358,25 +962,21 @@ static int cdcfs_read(const char *path, char *buf, size_t size, off_t offset, st
     }
     #endif
 
-    // read each block group into temp buffer
-    char tmp_buf[size + MAX_GROUP_SIZE];        // in some case we will read some useless data, so add MAX_GROUP_SIZE to avoid segmentation fault.
+    // the bytes of a group need to be read from disk, encoded groups are always read entirely
+    auto in_disk_interval = [&](group_addr *group) -> interval {
+        if (group_is_encoded(group)) return {(off_t)group->start_byte, (off_t)group->start_byte + group->stored_length};
+        return {group->start_byte + inter_group_interval[group].start, group->start_byte + inter_group_interval[group].end};
+    };
+
+    // plan the io of each container: groups sorted by their start byte, contiguous ones merged into one big io
+    struct read_io {off_t buf_start; off_t disk_start; size_t len;};
+    char tmp_buf[size + 2 * MAX_GROUP_SIZE];    // in some case we will read some useless data (first and last group may be compressed), so add 2 * MAX_GROUP_SIZE to avoid segmentation fault.
     std::map<group_addr *, interval> tmp_buf_map; // map group address contents and its start byte in temp buffer
+    std::map<INUM_TYPE, std::vector<read_io>> read_plan;
+    std::vector<uint64_t> device_bytes(zone_device_num + 1, 0);    // the last one is the BACKEND device
     off_t tmp_buf_len = 0;
     for (auto it = group_idx_of_inode.begin(); it!= group_idx_of_inode.end(); ++it) {
         INUM_TYPE cur_iNum = it->first;
-        DEBUG_MESSAGE("  reading iNum: " << cur_iNum);
-        uint64_t fh;
-        if (cur_iNum == iNum) fh = file_handler[fi->fh].fh;
-        else{
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s%s", BACKEND, iNum_to_path[cur_iNum].c_str());
-            DEBUG_MESSAGE("  tring to open: " << full_path);
-            fh = open(full_path, O_RDONLY | O_DIRECT);
-            if (fh == -1UL) {
-                DEBUG_MESSAGE("  open failed: " << strerror(errno));
-                return -errno;
-            }
-        }
         // sort group index by each group start bytes
         std::sort(it->second.begin(), it->second.end(), [](group_addr *group1, group_addr *group2) {
             return group1->start_byte < group2->start_byte;
@@ -384,19 +984,22 @@ static int cdcfs_read(const char *path, char *buf, size_t size, off_t offset, st
         for (uint32_t i = 0; i < it->second.size(); ++i){
             group_addr *cur_group = it->second[i];
             if (tmp_buf_map.find(cur_group) != tmp_buf_map.end()) continue; // have been read this block before
-            size_t inter_group_len = inter_group_interval[cur_group].end - inter_group_interval[cur_group].start;
+            interval cur_disk = in_disk_interval(cur_group);
+            size_t inter_group_len = cur_disk.end - cur_disk.start;
             tmp_buf_map[cur_group] = {tmp_buf_len, tmp_buf_len + (off_t)inter_group_len};
             tmp_buf_len += inter_group_len;
             // create a big continuous io
             uint32_t j = i;
-            off_t io_start = inter_group_interval[cur_group].start + cur_group->start_byte;
+            off_t io_start = cur_disk.start;
             size_t io_len = inter_group_len;
             while (++j < it->second.size()){
                 group_addr *next_group = it->second[j];
                 if (tmp_buf_map.find(next_group) != tmp_buf_map.end()) continue; // duplicate block ignore;
                 // next block is continuous
-                if (inter_group_interval[cur_group].end + cur_group->start_byte == inter_group_interval[next_group].start + next_group->start_byte){
-                    inter_group_len = inter_group_interval[next_group].end - inter_group_interval[next_group].start;
+                interval next_disk = in_disk_interval(next_group);
+                if (cur_disk.end == next_disk.start){
+                    cur_disk = next_disk;
+                    inter_group_len = next_disk.end - next_disk.start;
                     tmp_buf_map[next_group] = {tmp_buf_len, tmp_buf_len + (off_t)inter_group_len};
                     tmp_buf_len += inter_group_len;
                     io_len += inter_group_len;
@@ -406,26 +1009,90 @@ static int cdcfs_read(const char *path, char *buf, size_t size, off_t offset, st
                 // next block is not continuous
                 else break;
             }
-            DEBUG_MESSAGE("  reading " << "(" << (int)cur_iNum << ")" << " from " << io_start << " until " << io_len);
-            uint32_t res = pread(fh, tmp_buf + tmp_buf_len - io_len, io_len, io_start);
-            if (res != io_len) {
-                PRINT_WARNING("  reading  " << io_len << " bytes, but only " << res << " bytes are read");
+            read_plan[cur_iNum].push_back({tmp_buf_len - (off_t)io_len, io_start, io_len});
+            device_bytes[zone_device_of(cur_iNum)] += io_len;
+        }
+    }
+
+    // issue the io of every container, the containers of different devices (zone striping) in parallel
+    char *tmp_buf_ptr = tmp_buf;
+    auto read_container = [&](INUM_TYPE cur_iNum, const std::vector<read_io> &ios) -> int {
+        DEBUG_MESSAGE("  reading iNum: " << cur_iNum);
+        uint64_t fh;
+        if (cur_iNum == iNum) fh = file_handler[fi->fh].fh;
+        else{
+            char full_path[1024];
+            group_file_path(cur_iNum, full_path, sizeof(full_path));
+            DEBUG_MESSAGE("  tring to open: " << full_path);
+            fh = open(full_path, O_RDONLY | O_DIRECT);
+            if (fh == -1UL) {
+                DEBUG_MESSAGE("  open failed: " << strerror(errno));
+                return -errno;
+            }
+        }
+        for (const read_io &io : ios){
+            DEBUG_MESSAGE("  reading " << "(" << (int)cur_iNum << ")" << " from " << io.disk_start << " until " << io.len);
+            uint32_t res = pread(fh, tmp_buf_ptr + io.buf_start, io.len, io.disk_start);
+            if (res == (uint32_t)-1 && errno == EINVAL && cur_iNum != iNum) {    // backend rejects unaligned O_DIRECT io, fall back to buffered io
+                char full_path[1024];
+                group_file_path(cur_iNum, full_path, sizeof(full_path));
+                close(fh);
+                fh = open(full_path, O_RDONLY);
+                if (fh == -1UL) return -errno;
+                res = pread(fh, tmp_buf_ptr + io.buf_start, io.len, io.disk_start);
+            }
+            if (res != io.len) {
+                PRINT_WARNING("  reading  " << io.len << " bytes, but only " << res << " bytes are read");
                 PRINT_WARNING("");
-                if (cur_iNum == iNum) close(fh);
+                if (cur_iNum != iNum) close(fh);
                 return -1;
             }
         }
         if (cur_iNum != iNum) close(fh);
+        return 0;
+    };
+    std::vector<int> device_res(device_bytes.size(), 0);
+    zone_parallel(device_bytes, [&](uint32_t d){
+        zone_device *device = d < zone_device_num ? &zone_devices[d] : NULL;
+        for (const auto &[cur_iNum, ios] : read_plan){
+            if (zone_device_of(cur_iNum) != d) continue;
+            if (device) device->inflight++;
+            device_res[d] = read_container(cur_iNum, ios);
+            if (device) device->inflight--;
+            if (device_res[d] != 0) return;
+        }
+        if (device) device->read += device_bytes[d];
+    });
+    for (int res : device_res){
+        if (res != 0) return res;
     }
 
     // fill return buffer
     size_t read_size = 0;
     for (cur_group_idx = start_group_idx; cur_group_idx < end_group_idx; cur_group_idx++) {
-        group_addr *cur_group = mapping_table[iNum].group_pos[cur_group_idx];
+        group_addr *cur_group = group_of(mapping_table[iNum].group_pos[cur_group_idx]);
         off_t cur_group_offset = mapping_table[iNum].group_offset[cur_group_idx];
         off_t cur_inter_group_offset = cur_group_offset > offset ? 0 : offset - cur_group_offset;
-        size_t cur_inter_group_end = cur_group_offset + (size_t)cur_group->group_length < offset + size 
-                ? cur_group->group_length : offset + size - cur_group_offset;
+        uint64_t cur_group_length = extent_length(&mapping_table[iNum], cur_group_idx);
+        size_t cur_inter_group_end = cur_group_offset + cur_group_length < offset + size 
+                ? cur_group_length : offset + size - cur_group_offset;
+        if (cur_group->iNum == HOLE_INUM){
+            DEBUG_MESSAGE("  filling hole: " << cur_group_idx << " from " << cur_inter_group_offset << " to " << cur_inter_group_end);
+            memset(buf + read_size, 0, cur_inter_group_end - cur_inter_group_offset);
+            read_size += cur_inter_group_end - cur_inter_group_offset;
+            continue;
+        }
+        if (group_is_encoded(cur_group)){
+            char group_buf[MAX_GROUP_SIZE];
+            if (!decode_group(cur_group, tmp_buf + tmp_buf_map[cur_group].start, group_buf)){
+                PRINT_WARNING("  decode group of iNum " << cur_group->iNum << " at " << cur_group->start_byte << " failed");
+                return -EIO;
+            }
+            DEBUG_MESSAGE("  filling encoded group: " << cur_group_idx << " from " << cur_inter_group_offset << " to " << cur_inter_group_end);
+            memcpy(buf + read_size, group_buf + cur_inter_group_offset, cur_inter_group_end - cur_inter_group_offset);
+            read_size += cur_inter_group_end - cur_inter_group_offset;
+            continue;
+        }
         off_t in_tmp_buf_offset = tmp_buf_map[cur_group].start + (cur_inter_group_offset - inter_group_interval[cur_group].start);
         size_t in_tmp_buf_end = tmp_buf_map[cur_group].end - (inter_group_interval[cur_group].end - cur_inter_group_end);
         DEBUG_MESSAGE("  filling group: " << cur_group_idx << " from buffer: " << in_tmp_buf_offset << " to " << in_tmp_buf_end);
@@ -441,122 +1108,31 @@ static int cdcfs_write(const char *path, const char *buf, size_t size, off_t off
     INUM_TYPE iNum = file_handler[fi->fh].iNum;
     buffer_entry *in_buffer_data = &file_handler[fi->fh].write_buf;
 
-    if (in_buffer_data->start_byte > 0 && in_buffer_data->start_byte + in_buffer_data->byte_cnt != offset) {     // file buffer is not empty and current write is not continous.
-        PRINT_WARNING("write: detect not continous write in write buffer");
-        return -errno;
+    if (offset < (off_t)mapping_table[iNum].logical_size_for_host) {
+        PRINT_WARNING("write: currently not support data update.");
+        return -EINVAL;
     }
 
-    if (offset < (long int)mapping_table[iNum].actual_size_in_disk + in_buffer_data->byte_cnt) {
-        PRINT_WARNING("write: currently not support data update.");
-        return -errno;
+    if (offset > (off_t)mapping_table[iNum].logical_size_for_host) {   // sparse write, the gap becomes a hole
+        DEBUG_MESSAGE("  sparse write, hole until " << offset);
+        int res = extend_with_hole(fi->fh, offset);
+        if (res != 0) return res;
     }
 
     if (in_buffer_data->byte_cnt == 0) in_buffer_data->start_byte = offset;
 
     size_t less_size = size;
-    char * cur_buf_ptr = (char *)buf;
+    const char *cur_buf_ptr = buf;
     mapping_table[iNum].logical_size_for_host += size;
     while (less_size > 0) {
-        bool can_fill_buffer = in_buffer_data->byte_cnt + less_size >= MAX_GROUP_SIZE;
-        if (can_fill_buffer){
-            DEBUG_MESSAGE("  start write back file buffer");
-            int write_into_buffer_size = MAX_GROUP_SIZE - in_buffer_data->byte_cnt;
-            memcpy(in_buffer_data->content + in_buffer_data->byte_cnt, cur_buf_ptr, write_into_buffer_size);
-            less_size -= write_into_buffer_size;
-            cur_buf_ptr += write_into_buffer_size;
-            int cut_pos = cut((const uint8_t*)in_buffer_data->content, MAX_GROUP_SIZE, ctx->mi, ctx->ma, ctx->ns,
-                      ctx->mask_s, ctx->mask_l);
-            #ifdef CAFTL
-            cut_pos = BLOCK_SIZE; // use fixed chunking
-            #endif
-            DEBUG_MESSAGE("    cut pos: " << cut_pos << " byte cnt: " << in_buffer_data->byte_cnt);
-            std::unique_lock<std::shared_mutex> unique_status_record_lock(status_record_mutex);
-            total_write_size += cut_pos;
-            unique_status_record_lock.unlock();
-            // hashing
-            char cur_fp[SHA_DIGEST_LENGTH];
-            SHA1((const unsigned char *)in_buffer_data->content, cut_pos, (unsigned char *)cur_fp);
-            FP_TYPE new_fp(cur_fp, SHA_DIGEST_LENGTH);
-            // query fp store
-            #ifdef NODEDUPE
-                group_addr *new_group_addr = new group_addr;
-                new_group_addr->iNum = iNum;
-                new_group_addr->ref_times = 1;
-                new_group_addr->start_byte = mapping_table[iNum].actual_size_in_disk;
-                new_group_addr->group_length = cut_pos;
-                int res = pwrite(file_handler[fi->fh].fh, in_buffer_data->content, cut_pos, mapping_table[iNum].actual_size_in_disk);
-                if (res == -1){
-                    PRINT_WARNING("write: write back to disk failed!!");
-                    delete new_group_addr;
-                    return -errno;
-                }
-                mapping_table[iNum].actual_size_in_disk += cut_pos;
-                mapping_table[iNum].group_pos.push_back(new_group_addr);
-                mapping_table[iNum].group_offset.push_back(in_buffer_data->start_byte);
-                for(int i = mapping_table[iNum].group_idx.size(); i <= (in_buffer_data->start_byte + cut_pos) / BLOCK_SIZE; i++){
-                    mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
-                }
-                std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
-                fp_store[new_fp] = new_group_addr;
-                unique_fp_store_lock.unlock();
-            #endif
-            #ifndef NODEDUPE
-            std::shared_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
-            auto fp_store_iter = fp_store.find(new_fp);
-            shared_fp_store_lock.unlock();
-            if (fp_store_iter != fp_store.end()){   // found
-                DEBUG_MESSAGE("    found duplicate group!!");
-                unique_status_record_lock.lock();
-                total_dedup_size += cut_pos;
-                unique_status_record_lock.unlock();
-                fp_store_iter->second->ref_times += 1;
-                mapping_table[iNum].group_pos.push_back(fp_store_iter->second);
-                mapping_table[iNum].group_offset.push_back(in_buffer_data->start_byte);
-                for(int i = mapping_table[iNum].group_idx.size(); i <= (in_buffer_data->start_byte + cut_pos) / BLOCK_SIZE; i++){
-                    mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
-                }
-            }
-            else{                                   // not found
-                group_addr *new_group_addr = new group_addr;
-                new_group_addr->iNum = iNum;
-                new_group_addr->ref_times = 1;
-                new_group_addr->start_byte = mapping_table[iNum].actual_size_in_disk;
-                new_group_addr->group_length = cut_pos;
-                int res = pwrite(file_handler[fi->fh].fh, in_buffer_data->content, cut_pos, mapping_table[iNum].actual_size_in_disk);
-                if (res == -1){
-                    PRINT_WARNING("write: write back to disk failed!!");
-                    delete new_group_addr;
-                    return -errno;
-                }
-                mapping_table[iNum].actual_size_in_disk += cut_pos;
-                mapping_table[iNum].group_pos.push_back(new_group_addr);
-                mapping_table[iNum].group_offset.push_back(in_buffer_data->start_byte);
-                for(int i = mapping_table[iNum].group_idx.size(); i <= (in_buffer_data->start_byte + cut_pos) / BLOCK_SIZE; i++){
-                    mapping_table[iNum].group_idx.push_back(mapping_table[iNum].group_pos.size() - 1);
-                }
-                std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
-                fp_store[new_fp] = new_group_addr;
-                unique_fp_store_lock.unlock();
-            }
-            #endif
-            // update buffer
-            if (cut_pos < MAX_GROUP_SIZE){
-                //memcpy(in_buffer_data->content, in_buffer_data->content + cut_pos, MAX_GROUP_SIZE - cut_pos);
-                for (char *i = in_buffer_data->content + cut_pos, *j = in_buffer_data->content; i < in_buffer_data->content + MAX_GROUP_SIZE; i++, j++){
-                    *j = *i;
-                }
-            }
-            in_buffer_data->start_byte += cut_pos;
-            in_buffer_data->byte_cnt = MAX_GROUP_SIZE - cut_pos;
-        }
-        else{
-            DEBUG_MESSAGE("start fill buffer");
-            DEBUG_MESSAGE("in_buffer_data->byte_cnt: " << in_buffer_data->byte_cnt);
-            DEBUG_MESSAGE("less_size: " << less_size);
-            memcpy(in_buffer_data->content + in_buffer_data->byte_cnt, cur_buf_ptr, less_size);
-            DEBUG_MESSAGE("end fill buffer");
-            in_buffer_data->byte_cnt += less_size;
-            less_size = 0;
+        uint32_t fill_size = std::min(less_size, (size_t)(write_buffer_size - in_buffer_data->byte_cnt));
+        memcpy(in_buffer_data->content + in_buffer_data->byte_cnt, cur_buf_ptr, fill_size);
+        in_buffer_data->byte_cnt += fill_size;
+        cur_buf_ptr += fill_size;
+        less_size -= fill_size;
+        if (in_buffer_data->byte_cnt == write_buffer_size){     // full, commit every chunk that can't change anymore
+            int res = commit_write_buffer(fi->fh, false);
+            if (res != 0) return res;
         }
     }
     return size;
@@ -576,33 +1152,184 @@ static int cdcfs_write(const char *path, const char *buf, size_t size, off_t off
 }*/
 
 static int cdcfs_ftruncate(const char *path, off_t size, fuse_file_info *fi) {
-    int res;
-    return 0;
     DEBUG_MESSAGE("[ftruncate]" << path << ", size: " << size);
 
     if  (fi == NULL) {
-        return -errno;
+        return -EINVAL;
     }
+    // growing a file (preallocated / sparse image) only adds a hole, shrinking is not supported yet
+    if (file_handler[fi->fh].mode == 'w') return extend_with_hole(fi->fh, size);
+    return 0;
+}
 
-    res = ftruncate(file_handler[fi->fh].fh, size);
-    if (res == -1) {
-        return -errno;
+// SEEK_DATA / SEEK_HOLE over the mapping table, staged data in the write buffer counts as data.
+// not registered: fuse 2 has no lseek operation, only the bench harness calls it.
+inline off_t cdcfs_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi) {
+    DEBUG_MESSAGE("[lseek]" << path << " off: " << off << " whence: " << whence);
+    INUM_TYPE iNum = file_handler[fi->fh].iNum;
+    mapping_table_entry *entry = &mapping_table[iNum];
+    off_t file_size = entry->logical_size_for_host;
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) return -EINVAL;
+    if (off < 0 || off >= file_size) return -ENXIO;
+    // the group holding off, then the following ones
+    ssize_t found_group_idx = find_extent(entry, off);
+    for (size_t group_idx = found_group_idx < 0 ? entry->group_pos.size() : found_group_idx; group_idx < entry->group_pos.size(); group_idx++){
+        bool is_hole = group_of(entry->group_pos[group_idx])->iNum == HOLE_INUM;
+        if ((whence == SEEK_HOLE) == is_hole) return std::max(off, entry->group_offset[group_idx]);
     }
-    return 0;
+    // past the mapped groups there is only staged data, the end of file is a hole
+    if (whence == SEEK_HOLE) return file_size;
+    off_t committed_end = entry->mapped_end;
+    if (committed_end < file_size) return std::max(off, committed_end);
+    return -ENXIO;
 }
 
-/*static int cdcfs_unlink(const char *path) {
-    int res;
-    char full_path[1024];
-    snprintf(full_path, sizeof(full_path), "%s%s", BACKEND, path);
-    DEBUG_MESSAGE("unlink: " << path);
-    
-    res = unlink(full_path);
-    if (res == -1) {
-        return -errno;
+// copy [from, to) of the source to the end of the destination through the read and write path, used for the
+// partial groups at both ends of a clone. return 0 or -errno
+static int copy_range_data(const char *src_path, struct fuse_file_info *src_fi, off_t from, off_t to, const char *dst_path, struct fuse_file_info *dst_fi){
+    char buf[MAX_GROUP_SIZE];
+    INUM_TYPE dst_iNum = file_handler[dst_fi->fh].iNum;
+    for (off_t off = from; off < to; ){
+        int len = cdcfs_read(src_path, buf, std::min((off_t)sizeof(buf), to - off), off, src_fi);
+        if (len <= 0) return len < 0 ? len : -EIO;
+        int res = cdcfs_write(dst_path, buf, len, mapping_table[dst_iNum].logical_size_for_host, dst_fi);
+        if (res < 0) return res;
+        off += len;
     }
     return 0;
-}*/
+}
+
+// map len bytes of the source at src_off to dst_off, the end of the destination. Whole groups are shared with the
+// source (ref++) and need no io, only the partial groups at both ends are copied. Data still staged in a write
+// buffer of the source isn't cloned. return the bytes cloned or -errno
+inline ssize_t clone_range(const char *src_path, struct fuse_file_info *src_fi, off_t src_off, const char *dst_path, struct fuse_file_info *dst_fi, off_t dst_off, size_t len){
+    INUM_TYPE src_iNum = file_handler[src_fi->fh].iNum, dst_iNum = file_handler[dst_fi->fh].iNum;
+    mapping_table_entry *src = &mapping_table[src_iNum], *dst = &mapping_table[dst_iNum];
+    if (file_handler[dst_fi->fh].mode != 'w') return -EBADF;
+    if (src_iNum == dst_iNum || src_off < 0) return -EINVAL;
+    if (dst_off < (off_t)dst->logical_size_for_host){
+        PRINT_WARNING("clone: currently not support data update.");
+        return -EINVAL;
+    }
+    if (dst_off > (off_t)dst->logical_size_for_host){   // the gap becomes a hole, like a sparse write
+        int res = extend_with_hole(dst_fi->fh, dst_off);
+        if (res != 0) return res;
+    }
+    // snapshot the groups lying entirely inside [src_off, end) and take their references, while the writers of the
+    // source can't grow its mapping and no zone can bury them (see commit_batch). a hole can be cut anywhere, so
+    // the part of a hole inside the range is shared too
+    std::shared_lock<std::shared_mutex> shared_zone_reclaim_lock(zone_reclaim_mutex, std::defer_lock);
+    if (storage_mode == STORAGE_ZONE) shared_zone_reclaim_lock.lock();
+    std::shared_lock<std::shared_mutex> shared_mapping_lock(mapping_lock_of(src_iNum));
+    off_t committed_end = src->mapped_end;
+    if (src_off >= committed_end || len == 0) return 0;
+    off_t end = len < (size_t)(committed_end - src_off) ? src_off + (off_t)len : committed_end;
+    size_t first = find_extent(src, src_off);
+    if (src->group_offset[first] < src_off && group_of(src->group_pos[first])->iNum != HOLE_INUM) first++;
+    std::vector<GROUP_ID_TYPE> shared_groups;
+    std::vector<off_t> shared_offsets;
+    std::vector<uint64_t> shared_lengths;
+    for (size_t i = first; i < src->group_pos.size() && src->group_offset[i] < end; i++){
+        off_t from = std::max(src->group_offset[i], src_off), to = std::min(src->group_offset[i] + (off_t)extent_length(src, i), end);
+        if (group_of(src->group_pos[i])->iNum != HOLE_INUM && to - from < group_of(src->group_pos[i])->group_length) break;
+        shared_groups.push_back(src->group_pos[i]);
+        shared_offsets.push_back(from);
+        shared_lengths.push_back(to - from);
+    }
+    shared_mapping_lock.unlock();
+    auto put_shared = [&](size_t num){
+        for (size_t i = 0; i < num; i++){
+            if (group_of(shared_groups[i])->iNum != HOLE_INUM) put_group(shared_groups[i]);
+        }
+    };
+    for (size_t i = 0; i < shared_groups.size(); i++){
+        if (group_of(shared_groups[i])->iNum == HOLE_INUM || group_get_live(shared_groups[i])) continue;
+        put_shared(i);  // the source was unlinked meanwhile
+        return -ENOENT;
+    }
+    if (shared_zone_reclaim_lock.owns_lock()) shared_zone_reclaim_lock.unlock();
+    off_t shared_start = !shared_groups.empty() ? shared_offsets.front() : end;
+    off_t shared_end = !shared_groups.empty() ? shared_offsets.back() + (off_t)shared_lengths.back() : end;
+    int res = copy_range_data(src_path, src_fi, src_off, shared_start, dst_path, dst_fi);
+    if (res == 0 && !shared_groups.empty()) res = flush_write_buffer(dst_fi->fh);  // the shared groups follow the copied head
+    if (res != 0){
+        put_shared(shared_groups.size());
+        return res;
+    }
+    if (!shared_groups.empty()){
+        std::shared_lock<std::shared_mutex> shared_journal_checkpoint_lock(journal_checkpoint_mutex);
+        off_t dst_start = dst->logical_size_for_host;
+        std::unique_lock<std::shared_mutex> unique_mapping_lock(mapping_lock_of(dst_iNum));
+        reserve_mapping(dst_iNum, shared_groups.size());
+        std::vector<journal_extent> extents;
+        for (size_t i = 0; i < shared_groups.size(); i++){
+            GROUP_ID_TYPE id = shared_groups[i];
+            off_t offset = dst_start + (shared_offsets[i] - shared_start);
+            bool is_hole = group_of(id)->iNum == HOLE_INUM;
+            append_mapping(dst_iNum, id, offset, shared_lengths[i]);
+            extents.push_back({offset, shared_lengths[i], is_hole ? NO_GROUP : id});
+        }
+        unique_mapping_lock.unlock();
+        journal_log_extents(dst_iNum, extents.data(), extents.size());
+        dst->logical_size_for_host += shared_end - shared_start;
+        shared_journal_checkpoint_lock.unlock();
+        std::unique_lock<std::shared_mutex> unique_status_record_lock(status_record_mutex);
+        total_write_size += shared_end - shared_start;
+        total_dedup_size += shared_end - shared_start;
+    }
+    res = copy_range_data(src_path, src_fi, shared_end, end, dst_path, dst_fi);
+    if (res != 0) return res;
+    return end - src_off;
+}
+
+// copy_file_range clones instead of copying (see clone_range).
+// not registered: fuse 2 has no copy_file_range operation, only the bench harness calls it.
+inline ssize_t cdcfs_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in, const char *path_out,
+                                     struct fuse_file_info *fi_out, off_t offset_out, size_t size, int flags) {
+    DEBUG_MESSAGE("[copy_file_range]" << path_in << " offset: " << offset_in << " -> " << path_out << " offset: " << offset_out << " size: " << size);
+    if (flags != 0) return -EINVAL;
+    return clone_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size);
+}
+
+// read fragmentation of a file, see CDCFS_IOC_FRAG
+inline cdcfs_frag file_fragmentation(INUM_TYPE iNum){
+    mapping_table_entry *entry = &mapping_table[iNum];
+    cdcfs_frag frag = {};
+    std::unordered_set<INUM_TYPE> containers;
+    INUM_TYPE last = HOLE_INUM;
+    for (size_t i = 0; i < entry->group_pos.size(); i++){
+        group_addr *group = group_of(entry->group_pos[i]);
+        frag.size += extent_length(entry, i);
+        if (group->iNum == HOLE_INUM) continue;     // holes need no io and don't end a run
+        frag.groups++;
+        if (group->iNum != last) frag.runs++;
+        last = group->iNum;
+        containers.insert(group->iNum);
+    }
+    frag.containers = containers.size();
+    return frag;
+}
+
+static int cdcfs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data) {
+    DEBUG_MESSAGE("[ioctl]" << path << " cmd: " << cmd);
+
+    if (flags & FUSE_IOCTL_COMPAT) return -ENOSYS;
+    if ((unsigned int)cmd == CDCFS_IOC_FRAG){
+        *(cdcfs_frag *)data = file_fragmentation(file_handler[fi->fh].iNum);
+        return 0;
+    }
+    if ((unsigned int)cmd != CDCFS_IOC_CLONE) return -ENOTTY;
+    cdcfs_clone_arg *clone = (cdcfs_clone_arg *)data;
+    clone->src_path[sizeof(clone->src_path) - 1] = '\0';
+    struct fuse_file_info src_fi = {};
+    src_fi.flags = O_RDONLY;
+    int res = cdcfs_open(clone->src_path, &src_fi);
+    if (res != 0) return res;
+    ssize_t cloned = clone_range(clone->src_path, &src_fi, clone->src_offset, path, fi,
+                                 mapping_table[file_handler[fi->fh].iNum].logical_size_for_host, clone->length ? clone->length : SIZE_MAX);
+    cdcfs_release(clone->src_path, &src_fi);
+    return cloned < 0 ? cloned : 0;
+}
 
 static int cdcfs_readlink(const char *path, char *buf, size_t size) {
     int res;
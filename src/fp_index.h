@@ -0,0 +1,639 @@
+#ifndef FP_INDEX_H
+#define FP_INDEX_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <openssl/sha.h>
+#include <filesystem>
+#include <list>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include "def.h"
+#include "group_table.h"
+
+// Fingerprint index, fingerprint -> stored group.
+// "memory": every fingerprint lives in fp_store, RAM grows with the unique data.
+// "locality": DDFS style. New fingerprints are appended to on-disk segments in write order and an on-disk bucketed
+// hash table maps a fingerprint to its segment. The table grows by linear hashing, one page is split whenever the
+// load passes INDEX_BUCKET_LOAD, so overflow chains stay short without ever rehashing the whole table. A Bloom filter
+// in RAM answers most misses without io, and a hit on disk loads the whole segment into an LRU locality cache, so
+// the following fingerprints of a repeated stream hit in RAM. RAM only holds the Bloom filter, the open segment and
+// the cached segments. Segments hold the group handle with the generation of its slot, a fingerprint of a swept
+// group leads to NO_GROUP once the slot is recycled.
+// "sparse": sparse indexing (Lillibridge et al.). Every stream (file handler) writes the fingerprints of its chunks,
+// duplicates included, into manifests of INDEX_SEGMENT_ENTRIES chunks. Only sampled "hook" fingerprints (low
+// sample_bits bits zero) are kept in RAM, each pointing to the latest manifests having it. A stream buffers a segment
+// (its write buffer is at least INDEX_SPARSE_BUFFER), the hooks of the segment vote for the manifests having them and
+// the few best "champion" manifests are loaded before the segment is deduped against them. Chunks missing from the
+// champions are stored again, trading some dedup for RAM that is ~2^sample_bits times smaller.
+
+#define INDEX_MEMORY 0
+#define INDEX_LOCALITY 1
+#define INDEX_SPARSE 2
+
+#define INDEX_SEGMENT_ENTRIES 1024  // fingerprints per on-disk segment
+#define INDEX_BUCKET_SIZE 4096      // one page of the on-disk hash table
+#define INDEX_BUCKET_MIN 1024       // pages of the on-disk hash table at start, full pages chain to overflow pages
+#define INDEX_BUCKET_LOAD 75        // percent of the entries of the pages in use before a page is split
+#define INDEX_BLOOM_HASHES 4
+#define INDEX_DEFAULT_CACHE 64      // segments in the locality cache
+#define INDEX_DEFAULT_BLOOM 16      // MB of Bloom filter
+#define INDEX_DEFAULT_SAMPLE 6      // hooks have the low 6 bits zero, 1 fingerprint in 64
+#define INDEX_MAX_SAMPLE 16
+#define INDEX_DEFAULT_CHAMPIONS 4   // manifests a stream dedups against
+#define INDEX_HOOK_MANIFESTS 4      // latest manifests remembered per hook
+#define INDEX_SPARSE_BUFFER (8 * 1024 * 1024)   // smallest write buffer in "sparse", the segment a stream dedups at once
+
+// a group handle as the index keeps it
+struct index_group_ref{
+    GROUP_ID_TYPE id;
+    uint32_t gen;           // group_gen of the slot when indexed
+};
+
+struct index_segment_entry{
+    char fp[SHA_DIGEST_LENGTH];
+    index_group_ref group;
+};
+
+struct index_segment{
+    uint32_t entry_num;
+    index_segment_entry entry[INDEX_SEGMENT_ENTRIES];
+};
+
+struct __attribute__((packed)) index_bucket_entry{
+    uint64_t key;           // first 8 bytes of the fingerprint, the segment has the whole one
+    uint32_t segment_id;
+};
+
+#define INDEX_BUCKET_ENTRIES ((INDEX_BUCKET_SIZE - 2 * sizeof(uint32_t)) / sizeof(index_bucket_entry))
+
+struct index_bucket{
+    uint32_t entry_num;
+    uint32_t next;          // overflow page + 1, 0: none
+    index_bucket_entry entry[INDEX_BUCKET_ENTRIES];
+};
+
+struct index_cache_entry{
+    index_group_ref group;
+    uint32_t segment_id;
+};
+
+// a segment in the locality cache
+struct index_cached{
+    std::list<uint32_t>::iterator lru;
+    std::vector<FP_TYPE> fps;       // its fingerprints, erased from index_cache on eviction
+};
+
+// a manifest loaded for a stream
+struct index_champion{
+    uint32_t manifest_id;
+    std::unordered_map<FP_TYPE, index_group_ref> fp;
+};
+
+struct index_stream{
+    index_segment manifest;                             // chunks not written to a manifest yet
+    std::unordered_map<FP_TYPE, index_group_ref> manifest_fp;  // fp -> group of manifest
+    std::list<index_champion> champions;                // most recently hit first
+};
+
+struct fp_index_stat{
+    uint64_t lookups = 0;
+    uint64_t open_hits = 0;         // found in the open (not yet written) segment
+    uint64_t cache_hits = 0;        // found in the locality cache
+    uint64_t bloom_skips = 0;       // misses answered by the Bloom filter
+    uint64_t disk_lookups = 0;      // on-disk hash table walks
+    uint64_t false_positives = 0;   // disk lookups that found nothing
+    uint64_t segment_loads = 0;     // segments read into the locality cache / manifests loaded as champions
+    uint64_t sparse_segments = 0;   // segments that chose their champions
+    uint64_t hook_lookups = 0;      // hooks looked up in the sparse index
+};
+
+std::unordered_map<FP_TYPE, GROUP_ID_TYPE> fp_store;
+std::shared_mutex fp_store_mutex;       // the lock for access fp_store / the locality index
+
+int index_mode = INDEX_MEMORY;
+fp_index_stat index_stat;
+uint32_t index_cache_segments = INDEX_DEFAULT_CACHE;
+std::vector<uint64_t> index_bloom;
+int index_segment_fh = -1, index_bucket_fh = -1, index_overflow_fh = -1;
+uint32_t index_segment_num = 0;         // sealed segments
+uint32_t index_bucket_level = INDEX_BUCKET_MIN;    // pages of the on-disk hash table when the current split round began
+uint32_t index_bucket_split = 0;        // next page to split, pages below it already use key % (2 * level)
+uint32_t index_overflow_num = 0;        // pages of the overflow file
+std::vector<uint32_t> index_overflow_free;  // overflow pages released by splits
+uint64_t index_bucket_entry_num = 0;    // entries in the on-disk hash table
+index_segment index_open_segment;
+uint64_t index_fp_num = 0;              // fingerprints indexed
+std::unordered_map<FP_TYPE, index_group_ref> index_open_map;   // fp -> group of the open segment
+std::unordered_map<FP_TYPE, index_cache_entry> index_cache;    // fp of every cached segment
+std::list<uint32_t> index_lru;                                  // cached segments, most recent first
+std::unordered_map<uint32_t, index_cached> index_cached_segment;
+uint64_t index_sample_mask = (1ULL << INDEX_DEFAULT_SAMPLE) - 1;
+uint32_t index_champion_num = INDEX_DEFAULT_CHAMPIONS;
+std::unordered_map<uint64_t, std::vector<uint32_t>> index_hooks;   // hook -> manifests having it, oldest first
+index_stream *index_streams[MAX_FILE_HANDLER];
+
+// return -1 if name is unknown
+inline int fp_index_mode_of(const char *name){
+    if (strcmp(name, "memory") == 0) return INDEX_MEMORY;
+    if (strcmp(name, "locality") == 0) return INDEX_LOCALITY;
+    if (strcmp(name, "sparse") == 0) return INDEX_SPARSE;
+    return -1;
+}
+
+inline const char *fp_index_name(int mode){
+    switch (mode){
+        case INDEX_LOCALITY: return "locality";
+        case INDEX_SPARSE: return "sparse";
+        default: return "memory";
+    }
+}
+
+// create empty index files under INDEX_PATH, return -1 if they can't be opened.
+// cache_segments / bloom_mb tune "locality", sample_bits / champions tune "sparse"
+inline int fp_index_init(int mode, uint32_t cache_segments, uint32_t bloom_mb, uint32_t sample_bits, uint32_t champions){
+    index_mode = mode;
+    if (mode == INDEX_MEMORY) return 0;
+    index_cache_segments = cache_segments > 0 ? cache_segments : 1;
+    if (mode == INDEX_LOCALITY) index_bloom.assign((uint64_t)(bloom_mb > 0 ? bloom_mb : 1) * 1024 * 1024 / sizeof(uint64_t), 0);
+    index_sample_mask = (1ULL << std::min(sample_bits, (uint32_t)INDEX_MAX_SAMPLE)) - 1;
+    index_champion_num = champions > 0 ? champions : 1;
+    std::error_code ec;
+    std::filesystem::create_directories(INDEX_PATH, ec);
+    index_segment_fh = open(INDEX_PATH "/segments", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    index_bucket_fh = open(INDEX_PATH "/buckets", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    index_overflow_fh = open(INDEX_PATH "/overflow", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (index_segment_fh == -1 || index_bucket_fh == -1 || index_overflow_fh == -1) return -1;
+    return 0;
+}
+
+static inline uint64_t fp_key(const FP_TYPE &fp, int word){
+    uint64_t v;
+    memcpy(&v, fp.data() + word * 4, sizeof(v));    // words overlap by 4 bytes, 3 words cover the SHA1
+    return v;
+}
+
+static inline void bloom_add(const FP_TYPE &fp){
+    uint64_t bits = index_bloom.size() * 64, h1 = fp_key(fp, 2), h2 = fp_key(fp, 3) | 1;
+    for (int i = 0; i < INDEX_BLOOM_HASHES; i++){
+        uint64_t bit = (h1 + i * h2) % bits;
+        index_bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static inline bool bloom_test(const FP_TYPE &fp){
+    uint64_t bits = index_bloom.size() * 64, h1 = fp_key(fp, 2), h2 = fp_key(fp, 3) | 1;
+    for (int i = 0; i < INDEX_BLOOM_HASHES; i++){
+        uint64_t bit = (h1 + i * h2) % bits;
+        if (!(index_bloom[bit / 64] & (1ULL << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+// pages of the hash table live in index_bucket_fh, the overflow pages of their chains in index_overflow_fh
+static inline void read_bucket(int fh, uint32_t page, index_bucket *bucket){
+    if (pread(fh, bucket, sizeof(index_bucket), (off_t)page * INDEX_BUCKET_SIZE) != sizeof(index_bucket)){
+        memset(bucket, 0, sizeof(index_bucket));    // never written (sparse)
+    }
+}
+
+static inline void write_bucket(int fh, uint32_t page, const index_bucket *bucket){
+    if (pwrite(fh, bucket, sizeof(index_bucket), (off_t)page * INDEX_BUCKET_SIZE) != sizeof(index_bucket)){
+        PRINT_WARNING("write fingerprint index bucket failed!!");
+    }
+}
+
+// the page a key lives in
+static inline uint32_t bucket_page(uint64_t key){
+    uint32_t page = key % index_bucket_level;
+    if (page < index_bucket_split) page = key % (2 * (uint64_t)index_bucket_level);
+    return page;
+}
+
+// append entries to the chain of a page, every page of the chain is read and written once
+static void bucket_append(uint32_t page, const index_bucket_entry *entry, size_t num){
+    index_bucket bucket;
+    int fh = index_bucket_fh;
+    read_bucket(fh, page, &bucket);
+    while (bucket.next != 0){
+        fh = index_overflow_fh;
+        page = bucket.next - 1;
+        read_bucket(fh, page, &bucket);
+    }
+    for (size_t i = 0; i < num; i++){
+        if (bucket.entry_num == INDEX_BUCKET_ENTRIES){
+            uint32_t next;
+            if (!index_overflow_free.empty()){
+                next = index_overflow_free.back();
+                index_overflow_free.pop_back();
+            }
+            else next = index_overflow_num++;
+            bucket.next = next + 1;
+            write_bucket(fh, page, &bucket);
+            fh = index_overflow_fh;
+            page = next;
+            memset(&bucket, 0, sizeof(bucket));
+        }
+        bucket.entry[bucket.entry_num++] = entry[i];
+    }
+    write_bucket(fh, page, &bucket);
+}
+
+// linear hashing: split the chain of the next page between it and the page index_bucket_level above it,
+// only that chain is read and rewritten. its overflow pages go back to the free list
+static void bucket_split(){
+    uint32_t page = index_bucket_split, level = index_bucket_level;
+    index_bucket bucket;
+    std::vector<index_bucket_entry> low, high;
+    read_bucket(index_bucket_fh, page, &bucket);
+    while (true){
+        for (uint32_t i = 0; i < bucket.entry_num; i++){
+            (bucket.entry[i].key % (2 * (uint64_t)level) == page ? low : high).push_back(bucket.entry[i]);
+        }
+        if (bucket.next == 0) break;
+        index_overflow_free.push_back(bucket.next - 1);
+        read_bucket(index_overflow_fh, bucket.next - 1, &bucket);
+    }
+    memset(&bucket, 0, sizeof(bucket));
+    write_bucket(index_bucket_fh, page, &bucket);
+    if (++index_bucket_split == level){
+        index_bucket_level = level * 2;
+        index_bucket_split = 0;
+    }
+    if (!low.empty()) bucket_append(page, low.data(), low.size());
+    if (!high.empty()) bucket_append(page + level, high.data(), high.size());
+}
+
+// segments that may hold a fingerprint starting with key
+static std::vector<uint32_t> bucket_find(uint64_t key){
+    std::vector<uint32_t> segment_ids;
+    index_bucket bucket;
+    read_bucket(index_bucket_fh, bucket_page(key), &bucket);
+    while (true){
+        for (uint32_t i = 0; i < bucket.entry_num; i++){
+            if (bucket.entry[i].key == key) segment_ids.push_back(bucket.entry[i].segment_id);
+        }
+        if (bucket.next == 0) break;
+        read_bucket(index_overflow_fh, bucket.next - 1, &bucket);
+    }
+    return segment_ids;
+}
+
+// the group an index entry points to, NO_GROUP if its slot has been recycled since
+static inline GROUP_ID_TYPE index_group_of(const index_group_ref &ref){
+    return ref.id != NO_GROUP && group_gen(ref.id) == ref.gen ? ref.id : NO_GROUP;
+}
+
+// put a segment at the front of the locality cache, evict the least recently used ones.
+// a fingerprint cached by a newer segment too stays when the older one is evicted
+static void cache_segment(uint32_t segment_id, const index_segment *segment){
+    index_lru.push_front(segment_id);
+    index_cached &cached = index_cached_segment[segment_id];
+    cached.lru = index_lru.begin();
+    cached.fps.reserve(segment->entry_num);
+    for (uint32_t i = 0; i < segment->entry_num; i++){
+        cached.fps.emplace_back(segment->entry[i].fp, SHA_DIGEST_LENGTH);
+        index_cache[cached.fps.back()] = {segment->entry[i].group, segment_id};
+    }
+    while (index_lru.size() > index_cache_segments){
+        uint32_t victim = index_lru.back();
+        index_lru.pop_back();
+        auto victim_it = index_cached_segment.find(victim);
+        for (const FP_TYPE &fp : victim_it->second.fps){
+            auto it = index_cache.find(fp);
+            if (it != index_cache.end() && it->second.segment_id == victim) index_cache.erase(it);
+        }
+        index_cached_segment.erase(victim_it);
+    }
+}
+
+// read a sealed segment into the locality cache
+static bool load_segment(uint32_t segment_id){
+    static index_segment segment;
+    if (pread(index_segment_fh, &segment, sizeof(segment), (off_t)segment_id * sizeof(index_segment)) != sizeof(segment)) return false;
+    index_stat.segment_loads++;
+    cache_segment(segment_id, &segment);
+    return true;
+}
+
+// write the open segment and index its fingerprints on disk, it stays cached as the most recent stream position.
+// the keys are sorted by page, so every page is updated once per segment
+static void seal_open_segment(){
+    uint32_t segment_id = index_segment_num++;
+    if (pwrite(index_segment_fh, &index_open_segment, sizeof(index_segment), (off_t)segment_id * sizeof(index_segment)) != sizeof(index_segment)){
+        PRINT_WARNING("write fingerprint index segment failed!!");
+    }
+    uint32_t num = index_open_segment.entry_num;
+    index_bucket_entry_num += num;
+    while (index_bucket_entry_num * 100 > (uint64_t)(index_bucket_level + index_bucket_split) * INDEX_BUCKET_ENTRIES * INDEX_BUCKET_LOAD){
+        bucket_split();
+    }
+    std::vector<index_bucket_entry> entries(num);
+    for (uint32_t i = 0; i < num; i++){
+        entries[i] = {fp_key(FP_TYPE(index_open_segment.entry[i].fp, SHA_DIGEST_LENGTH), 0), segment_id};
+    }
+    std::sort(entries.begin(), entries.end(), [](const index_bucket_entry &a, const index_bucket_entry &b){
+        return bucket_page(a.key) < bucket_page(b.key);
+    });
+    for (uint32_t i = 0, j; i < num; i = j){
+        uint32_t page = bucket_page(entries[i].key);
+        for (j = i + 1; j < num && bucket_page(entries[j].key) == page; j++);
+        bucket_append(page, &entries[i], j - i);
+    }
+    cache_segment(segment_id, &index_open_segment);
+    index_open_map.clear();
+    index_open_segment.entry_num = 0;
+}
+
+static GROUP_ID_TYPE locality_lookup(const FP_TYPE &fp){
+    auto open_it = index_open_map.find(fp);
+    if (open_it != index_open_map.end()){
+        index_stat.open_hits++;
+        return index_group_of(open_it->second);
+    }
+    auto cache_it = index_cache.find(fp);
+    if (cache_it != index_cache.end()){
+        index_stat.cache_hits++;
+        index_lru.splice(index_lru.begin(), index_lru, index_cached_segment[cache_it->second.segment_id].lru);
+        return index_group_of(cache_it->second.group);
+    }
+    if (!bloom_test(fp)){
+        index_stat.bloom_skips++;
+        return NO_GROUP;
+    }
+    index_stat.disk_lookups++;
+    for (uint32_t segment_id : bucket_find(fp_key(fp, 0))){
+        if (index_cached_segment.count(segment_id) || !load_segment(segment_id)) continue;
+        cache_it = index_cache.find(fp);
+        if (cache_it != index_cache.end()) return index_group_of(cache_it->second.group);
+    }
+    index_stat.false_positives++;
+    return NO_GROUP;
+}
+
+static inline bool is_hook(const FP_TYPE &fp){
+    return (fp_key(fp, 0) & index_sample_mask) == 0;
+}
+
+static index_stream *get_stream(FILE_HANDLER_INDEX_TYPE stream_idx){
+    if (index_streams[stream_idx] == NULL){
+        index_streams[stream_idx] = new index_stream();
+    }
+    return index_streams[stream_idx];
+}
+
+static void add_champion(index_stream *stream, uint32_t manifest_id, std::unordered_map<FP_TYPE, index_group_ref> &&fp){
+    stream->champions.push_front({manifest_id, std::move(fp)});
+    if (stream->champions.size() > index_champion_num) stream->champions.pop_back();
+}
+
+static bool read_champion(uint32_t manifest_id, std::unordered_map<FP_TYPE, index_group_ref> *fp){
+    static index_segment manifest;
+    if (pread(index_segment_fh, &manifest, sizeof(manifest), (off_t)manifest_id * sizeof(index_segment)) != sizeof(manifest)) return false;
+    index_stat.segment_loads++;
+    for (uint32_t i = 0; i < manifest.entry_num; i++){
+        (*fp)[FP_TYPE(manifest.entry[i].fp, SHA_DIGEST_LENGTH)] = manifest.entry[i].group;
+    }
+    return true;
+}
+
+// pick the champions of a segment: every hook of the segment votes for the manifests having it, the manifest with the
+// most votes wins and its hooks stop voting, until index_champion_num are chosen or no hook is left. winners already
+// loaded are kept, the others are read, and the former champions fill the places left
+static void choose_champions(index_stream *stream, const FP_TYPE *fps, size_t num){
+    index_stat.sparse_segments++;
+    std::vector<const std::vector<uint32_t> *> hooks;
+    std::unordered_set<uint64_t> seen;
+    for (size_t i = 0; i < num; i++){
+        if (!is_hook(fps[i]) || !seen.insert(fp_key(fps[i], 0)).second) continue;
+        index_stat.hook_lookups++;
+        auto hook_it = index_hooks.find(fp_key(fps[i], 0));
+        if (hook_it != index_hooks.end()) hooks.push_back(&hook_it->second);
+    }
+    std::vector<uint32_t> chosen;
+    std::unordered_map<uint32_t, uint32_t> votes;
+    while (chosen.size() < index_champion_num && !hooks.empty()){
+        votes.clear();
+        uint32_t best = 0, best_votes = 0;
+        for (const std::vector<uint32_t> *manifests : hooks){
+            for (uint32_t manifest_id : *manifests){
+                uint32_t v = ++votes[manifest_id];
+                if (v > best_votes || (v == best_votes && manifest_id > best)){    // ties go to the latest manifest
+                    best = manifest_id;
+                    best_votes = v;
+                }
+            }
+        }
+        chosen.push_back(best);
+        hooks.erase(std::remove_if(hooks.begin(), hooks.end(), [best](const std::vector<uint32_t> *manifests){
+            return std::find(manifests->begin(), manifests->end(), best) != manifests->end();
+        }), hooks.end());
+    }
+    std::list<index_champion> champions;
+    for (uint32_t manifest_id : chosen){
+        auto it = std::find_if(stream->champions.begin(), stream->champions.end(), [manifest_id](const index_champion &champion){
+            return champion.manifest_id == manifest_id;
+        });
+        if (it != stream->champions.end()){
+            champions.splice(champions.end(), stream->champions, it);
+            continue;
+        }
+        champions.push_back({manifest_id, {}});
+        if (!read_champion(manifest_id, &champions.back().fp)) champions.pop_back();
+    }
+    while (champions.size() < index_champion_num && !stream->champions.empty()){
+        champions.splice(champions.end(), stream->champions, stream->champions.begin());
+    }
+    stream->champions.swap(champions);
+}
+
+// write the manifest of a stream and remember its hooks, the stream keeps it as a champion
+static void seal_manifest(index_stream *stream){
+    if (stream->manifest.entry_num == 0) return;
+    uint32_t manifest_id = index_segment_num++;
+    if (pwrite(index_segment_fh, &stream->manifest, sizeof(index_segment), (off_t)manifest_id * sizeof(index_segment)) != sizeof(index_segment)){
+        PRINT_WARNING("write fingerprint index manifest failed!!");
+    }
+    for (uint32_t i = 0; i < stream->manifest.entry_num; i++){
+        FP_TYPE fp(stream->manifest.entry[i].fp, SHA_DIGEST_LENGTH);
+        if (!is_hook(fp)) continue;
+        std::vector<uint32_t> &manifests = index_hooks[fp_key(fp, 0)];
+        if (!manifests.empty() && manifests.back() == manifest_id) continue;
+        manifests.push_back(manifest_id);
+        if (manifests.size() > INDEX_HOOK_MANIFESTS) manifests.erase(manifests.begin());
+    }
+    add_champion(stream, manifest_id, std::move(stream->manifest_fp));
+    stream->manifest_fp.clear();
+    stream->manifest.entry_num = 0;
+}
+
+static void manifest_append(index_stream *stream, const FP_TYPE &fp, index_group_ref group){
+    index_segment_entry *entry = &stream->manifest.entry[stream->manifest.entry_num++];
+    memcpy(entry->fp, fp.data(), SHA_DIGEST_LENGTH);
+    entry->group = group;
+    stream->manifest_fp[fp] = group;
+    if (stream->manifest.entry_num == INDEX_SEGMENT_ENTRIES) seal_manifest(stream);
+}
+
+static bool champion_find(index_stream *stream, const FP_TYPE &fp, index_group_ref *group){
+    for (auto it = stream->champions.begin(); it != stream->champions.end(); ++it){
+        auto fp_it = it->fp.find(fp);
+        if (fp_it == it->fp.end()) continue;
+        *group = fp_it->second;
+        stream->champions.splice(stream->champions.begin(), stream->champions, it);
+        return true;
+    }
+    return false;
+}
+
+// look up a chunk of a segment whose champions are chosen, only the open manifest and the champions are searched.
+// a hit is recorded in the manifest of the stream too, so the manifest describes the whole stream
+static GROUP_ID_TYPE sparse_lookup(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE &fp){
+    index_stream *stream = get_stream(stream_idx);
+    auto open_it = stream->manifest_fp.find(fp);
+    if (open_it != stream->manifest_fp.end()){
+        index_stat.open_hits++;
+        return index_group_of(open_it->second);
+    }
+    index_group_ref group;
+    if (!champion_find(stream, fp, &group)) return NO_GROUP;
+    index_stat.cache_hits++;
+    manifest_append(stream, fp, group);
+    return index_group_of(group);
+}
+
+static GROUP_ID_TYPE lookup_locked(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE &fp){
+    GROUP_ID_TYPE group;
+    if (index_mode == INDEX_MEMORY){
+        auto it = fp_store.find(fp);
+        group = it != fp_store.end() ? it->second : NO_GROUP;
+    }
+    else{
+        index_stat.lookups++;
+        group = index_mode == INDEX_SPARSE ? sparse_lookup(stream_idx, fp) : locality_lookup(fp);
+    }
+    return group != NO_GROUP && group_ref(group) > 0 ? group : NO_GROUP;  // groups of deleted files stay indexed but dead
+}
+
+static void insert_locked(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE &fp, GROUP_ID_TYPE group){
+    if (index_mode == INDEX_MEMORY){
+        fp_store[fp] = group;
+        return;
+    }
+    index_group_ref ref = {group, group_gen(group)};
+    index_fp_num++;
+    if (index_mode == INDEX_SPARSE){
+        manifest_append(get_stream(stream_idx), fp, ref);
+        return;
+    }
+    index_segment_entry *entry = &index_open_segment.entry[index_open_segment.entry_num++];
+    memcpy(entry->fp, fp.data(), SHA_DIGEST_LENGTH);
+    entry->group = ref;
+    index_open_map[fp] = ref;
+    bloom_add(fp);
+    if (index_open_segment.entry_num == INDEX_SEGMENT_ENTRIES) seal_open_segment();
+}
+
+// return NO_GROUP if fp has never been stored (or, in sparse mode, is not in the champions of the stream)
+inline GROUP_ID_TYPE fp_index_lookup(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE &fp){
+    if (index_mode == INDEX_MEMORY){
+        std::shared_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
+        return lookup_locked(stream_idx, fp);
+    }
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);     // lookups move the caches
+    if (index_mode == INDEX_SPARSE) choose_champions(get_stream(stream_idx), &fp, 1);
+    return lookup_locked(stream_idx, fp);
+}
+
+// look up num fingerprints with one lock acquisition, groups[i] is NO_GROUP if fps[i] is not found.
+// in sparse mode the batch is the segment of the stream, cut every INDEX_SEGMENT_ENTRIES chunks
+inline void fp_index_lookup_batch(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE *fps, size_t num, GROUP_ID_TYPE *groups){
+    if (index_mode == INDEX_MEMORY){
+        std::shared_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
+        for (size_t i = 0; i < num; i++) groups[i] = lookup_locked(stream_idx, fps[i]);
+        return;
+    }
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
+    for (size_t i = 0; i < num; i++){
+        if (index_mode == INDEX_SPARSE && i % INDEX_SEGMENT_ENTRIES == 0){
+            choose_champions(get_stream(stream_idx), fps + i, std::min(num - i, (size_t)INDEX_SEGMENT_ENTRIES));
+        }
+        groups[i] = lookup_locked(stream_idx, fps[i]);
+    }
+}
+
+inline void fp_index_insert(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE &fp, GROUP_ID_TYPE group){
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
+    insert_locked(stream_idx, fp, group);
+}
+
+inline void fp_index_insert_batch(FILE_HANDLER_INDEX_TYPE stream_idx, const FP_TYPE *fps, size_t num, const GROUP_ID_TYPE *groups){
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
+    for (size_t i = 0; i < num; i++) insert_locked(stream_idx, fps[i], groups[i]);
+}
+
+// drop the handles of swept groups (dead[id] set), so their slots can be recycled. the other modes keep them, the
+// generation of a recycled slot no longer matches
+inline void fp_index_forget(const std::vector<bool> &dead){
+    if (index_mode != INDEX_MEMORY) return;
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
+    for (auto it = fp_store.begin(); it != fp_store.end(); ){
+        if (it->second < dead.size() && dead[it->second]) it = fp_store.erase(it);
+        else ++it;
+    }
+}
+
+// the stream of a file handler ended, write its last manifest
+inline void fp_index_close_stream(FILE_HANDLER_INDEX_TYPE stream_idx){
+    if (index_mode != INDEX_SPARSE) return;
+    std::unique_lock<std::shared_mutex> unique_fp_store_lock(fp_store_mutex);
+    if (index_streams[stream_idx] == NULL) return;
+    seal_manifest(index_streams[stream_idx]);
+    delete index_streams[stream_idx];
+    index_streams[stream_idx] = NULL;
+}
+
+// the write buffer of every stream, raised to a whole segment in sparse mode
+inline uint32_t fp_index_write_buffer(uint32_t write_buffer){
+    return index_mode == INDEX_SPARSE ? std::max(write_buffer, (uint32_t)INDEX_SPARSE_BUFFER) : write_buffer;
+}
+
+// unique fingerprints indexed
+inline uint64_t fp_index_size(){
+    std::shared_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
+    return index_mode == INDEX_MEMORY ? fp_store.size() : index_fp_num;
+}
+
+// rough RAM used by an unordered_map node holding a fingerprint (the 20 byte string is on the heap)
+template <typename V>
+static inline uint64_t fp_map_node_bytes(){
+    return sizeof(std::pair<const FP_TYPE, V>) + 2 * sizeof(void *) + 32;
+}
+
+// estimated RAM of the index itself, the group table is counted by neither mode
+inline uint64_t fp_index_memory(){
+    std::shared_lock<std::shared_mutex> shared_fp_store_lock(fp_store_mutex);
+    if (index_mode == INDEX_MEMORY) return fp_store.size() * fp_map_node_bytes<GROUP_ID_TYPE>();
+    if (index_mode == INDEX_SPARSE){
+        uint64_t bytes = 0;
+        for (const auto &hook : index_hooks){
+            bytes += sizeof(hook) + 2 * sizeof(void *) + hook.second.capacity() * sizeof(uint32_t);
+        }
+        for (const index_stream *stream : index_streams){
+            if (stream == NULL) continue;
+            bytes += sizeof(index_stream) + stream->manifest_fp.size() * fp_map_node_bytes<index_group_ref>();
+            for (const index_champion &champion : stream->champions) bytes += champion.fp.size() * fp_map_node_bytes<index_group_ref>();
+        }
+        return bytes;
+    }
+    return index_bloom.size() * sizeof(uint64_t) + sizeof(index_segment)
+           + index_open_map.size() * fp_map_node_bytes<index_group_ref>()
+           + index_cache.size() * fp_map_node_bytes<index_cache_entry>()
+           + index_cached_segment.size() * INDEX_SEGMENT_ENTRIES * (sizeof(FP_TYPE) + 32);
+}
+
+#endif /* FP_INDEX_H */
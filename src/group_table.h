@@ -0,0 +1,122 @@
+#ifndef GROUP_TABLE_H
+#define GROUP_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "def.h"
+
+// Group table: every group_addr lives in a slab of GROUP_SLAB_SIZE groups and is addressed by a 32-bit handle
+// (slab number, slot), so the mapping table, the fingerprint index and the zones hold 4 bytes per group instead of
+// a pointer to its own heap block. Reference counts are a dense array of atomics of their own in every slab, the hot
+// ref++ of dedup doesn't touch the group itself and needs no lock. A dead group (ref 0) never comes back to life:
+// references to an existing group are only taken by group_get_live, so zone reclaim may bury any group it sees at 0.
+// A slab never moves, so a group_addr * stays valid while its handle lives.
+// A group nobody references can't be reused at once, the fingerprint index, sf_store and the journal may still hold
+// its handle: it is buried as a tombstone and group_sweep drops those handles before its slot is recycled. The on-disk
+// fingerprint index can't drop them, it keeps the generation of the slot next to the handle and a recycled slot has a
+// new one.
+
+#define GROUP_SLAB_BITS 16
+#define GROUP_SLAB_SIZE (1U << GROUP_SLAB_BITS)             // groups per slab
+#define GROUP_MAX_SLABS (1U << (32 - GROUP_SLAB_BITS))
+#define NO_GROUP ((GROUP_ID_TYPE)0)                         // handle 0 is never handed out
+#define GROUP_SWEEP_MIN 1024                                // tombstones before a sweep is worth it
+
+struct group_slab{
+    group_addr group[GROUP_SLAB_SIZE];
+    std::atomic<uint32_t> ref[GROUP_SLAB_SIZE];     // how many times each group is referenced
+    uint32_t gen[GROUP_SLAB_SIZE];                  // times each slot has been recycled
+};
+
+group_slab *group_slabs[GROUP_MAX_SLABS];
+GROUP_ID_TYPE group_next = 1;               // handles from here on have never been handed out
+std::vector<GROUP_ID_TYPE> group_free_ids;  // recycled slots
+std::vector<GROUP_ID_TYPE> group_tombstones;    // dead groups whose handle may still be indexed
+std::mutex group_table_mutex;               // the lock for allocating and freeing slots
+
+inline group_addr *group_of(GROUP_ID_TYPE id){
+    return &group_slabs[id >> GROUP_SLAB_BITS]->group[id & (GROUP_SLAB_SIZE - 1)];
+}
+
+inline std::atomic<uint32_t> &group_ref(GROUP_ID_TYPE id){
+    return group_slabs[id >> GROUP_SLAB_BITS]->ref[id & (GROUP_SLAB_SIZE - 1)];
+}
+
+inline uint32_t &group_gen(GROUP_ID_TYPE id){
+    return group_slabs[id >> GROUP_SLAB_BITS]->gen[id & (GROUP_SLAB_SIZE - 1)];
+}
+
+// take one more reference of a group that is still alive, return false if it is already dead
+inline bool group_get_live(GROUP_ID_TYPE id){
+    std::atomic<uint32_t> &ref = group_ref(id);
+    uint32_t cur = ref.load();
+    while (cur > 0){
+        if (ref.compare_exchange_weak(cur, cur + 1)) return true;
+    }
+    return false;
+}
+
+// drop one reference, return true if it was the last one (a dead group is left as it is)
+inline bool group_drop(GROUP_ID_TYPE id){
+    std::atomic<uint32_t> &ref = group_ref(id);
+    uint32_t cur = ref.load();
+    while (cur > 0){
+        if (ref.compare_exchange_weak(cur, cur - 1)) return cur == 1;
+    }
+    return false;
+}
+
+// a zeroed group with no reference, NO_GROUP if the table is full
+inline GROUP_ID_TYPE group_alloc(){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    GROUP_ID_TYPE id;
+    if (!group_free_ids.empty()){
+        id = group_free_ids.back();
+        group_free_ids.pop_back();
+    }
+    else{
+        if (group_next == NO_GROUP){
+            PRINT_WARNING("run out of group handles");
+            return NO_GROUP;
+        }
+        if (group_slabs[group_next >> GROUP_SLAB_BITS] == NULL) group_slabs[group_next >> GROUP_SLAB_BITS] = new group_slab();
+        id = group_next++;
+    }
+    memset(group_of(id), 0, sizeof(group_addr));
+    group_ref(id) = 0;
+    return id;
+}
+
+// the slot of a group nothing can point to (never indexed) is reusable at once
+inline void group_free(GROUP_ID_TYPE id){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    group_free_ids.push_back(id);
+}
+
+// a dead group left its zone, its slot is recycled by the next sweep
+inline void group_bury(GROUP_ID_TYPE id){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    group_tombstones.push_back(id);
+}
+
+inline bool group_want_sweep(){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    return group_tombstones.size() >= GROUP_SWEEP_MIN && group_tombstones.size() * 8 >= group_next;
+}
+
+// groups in use (tombstones included) and bytes of the allocated slabs
+inline uint64_t group_table_size(){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    return group_next - 1 - group_free_ids.size();
+}
+
+inline uint64_t group_table_memory(){
+    std::lock_guard<std::mutex> group_table_lock(group_table_mutex);
+    return (((uint64_t)group_next + GROUP_SLAB_SIZE - 1) >> GROUP_SLAB_BITS) * sizeof(group_slab)
+           + (group_free_ids.capacity() + group_tombstones.capacity()) * sizeof(GROUP_ID_TYPE);
+}
+
+#endif /* GROUP_TABLE_H */
@@ -0,0 +1,62 @@
+#ifndef HOLE_H
+#define HOLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "def.h"
+#include "group_table.h"
+
+// Zero ranges (sparse files, preallocated images) are kept as hole extents in the mapping table: a hole group
+// has iNum HOLE_INUM, is never hashed, written or read, and cdcfs_read fills it with memset. A hole extent runs until
+// the next extent of its file (see extent_length), so a zero run of any length is one extent.
+
+#define HOLE_MIN_LENGTH BLOCK_SIZE  // shorter zero runs are chunked as normal data
+
+// length of the all-zero prefix of src
+inline uint32_t zero_prefix_length(const char *src, uint32_t len){
+    uint32_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= len; i += 64){
+        const __m128i *cur = (const __m128i *)(src + i);
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(cur), _mm_loadu_si128(cur + 1)),
+                                 _mm_or_si128(_mm_loadu_si128(cur + 2), _mm_loadu_si128(cur + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) break;
+    }
+#endif
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)){
+        uint64_t v;
+        memcpy(&v, src + i, sizeof(v));
+        if (v != 0) break;
+    }
+    for (; i < len && src[i] == 0; i++);
+    return i;
+}
+
+// offset of the first all-zero HOLE_MIN_LENGTH block of src, len if there is none.
+// data groups are not cut across it, so the zero run becomes a hole of its own.
+inline uint32_t first_zero_block(const char *src, uint32_t len){
+    for (uint32_t blk = 0; blk + HOLE_MIN_LENGTH <= len; blk += HOLE_MIN_LENGTH){
+        if (zero_prefix_length(src + blk, HOLE_MIN_LENGTH) == HOLE_MIN_LENGTH) return blk;
+    }
+    return len;
+}
+
+// the hole group is shared by every hole extent and never freed
+GROUP_ID_TYPE hole_group = NO_GROUP;
+std::mutex hole_group_mutex;
+
+inline GROUP_ID_TYPE get_hole_group(){
+    std::lock_guard<std::mutex> hole_group_lock(hole_group_mutex);
+    if (hole_group == NO_GROUP){
+        hole_group = group_alloc();
+        group_of(hole_group)->iNum = HOLE_INUM;
+    }
+    return hole_group;
+}
+
+#endif /* HOLE_H */
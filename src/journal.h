@@ -0,0 +1,448 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <openssl/sha.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include "def.h"
+#include "group_table.h"
+
+// Write-ahead metadata journal ("-o journal").
+// Group data always reaches the backend before its metadata. Every metadata update (file binding, stored group,
+// mapping, unlink, zone reclaim) is appended as a record to an in-memory log, which costs no io. fsync makes the
+// log durable by group commit: the first caller becomes the leader, fdatasyncs the data files written since the last
+// commit, writes every pending record and fdatasyncs the journal once. fsyncs arriving meanwhile wait and are covered by the next flush,
+// so N concurrent fsyncs cost two device flushes instead of N.
+// When the journal grows past journal_size, a checkpoint writes the whole metadata as records into a new checkpoint
+// file and empties the journal, so "-o recover" replays one checkpoint and at most journal_size bytes of journal.
+
+#define JOURNAL_FILE 1      // an iNum is bound to a path
+#define JOURNAL_GROUP 2     // a unique group is stored
+#define JOURNAL_MAP 3       // a range of a file is mapped to a group or a hole
+#define JOURNAL_UNLINK 4    // a file is unlinked
+#define JOURNAL_MOVE 5      // zone reclaim moved a group
+#define JOURNAL_ZONE 6      // write pointer of a zone, 0: the zone is reset
+
+#define JOURNAL_NO_ID UINT32_MAX    // hole extents and groups without delta base
+#define JOURNAL_DEFAULT_SIZE 64     // MB of journal before a checkpoint
+#define JOURNAL_MAX_SIZE 4096       // MB
+#define JOURNAL_MAX_CLOSED 256      // written files kept open for the next commit after release
+
+struct __attribute__((packed)) journal_header{
+    uint32_t checksum;      // of type, length and payload, a torn tail fails it
+    uint8_t type;
+    uint16_t length;        // payload bytes
+};
+
+struct __attribute__((packed)) journal_file_record{
+    uint32_t iNum;          // followed by the path for JOURNAL_FILE
+};
+
+struct __attribute__((packed)) journal_group_record{
+    uint32_t id;
+    uint32_t base_id;       // delta base
+    uint64_t iNum;
+    uint32_t start_byte;
+    uint16_t group_length;
+    uint16_t stored_length;
+    uint8_t compress_type;
+    char fp[SHA_DIGEST_LENGTH];
+};
+
+struct __attribute__((packed)) journal_map_record{
+    uint32_t iNum;
+    uint32_t id;            // JOURNAL_NO_ID: hole
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct __attribute__((packed)) journal_move_record{
+    uint32_t id;
+    uint64_t iNum;
+    uint32_t start_byte;
+};
+
+struct __attribute__((packed)) journal_zone_record{
+    uint32_t zone;
+    uint64_t wp;
+};
+
+// a mapped range of a file, group is NO_GROUP for a hole
+struct journal_extent{
+    off_t offset;
+    uint64_t length;
+    GROUP_ID_TYPE group;
+};
+
+// a journaled group, the index may only have its fingerprint on disk so the journal keeps it for checkpoints
+struct journal_group_entry{
+    GROUP_ID_TYPE group;
+    char fp[SHA_DIGEST_LENGTH];
+};
+
+struct journal_stat{
+    uint64_t records = 0;
+    uint64_t commits = 0;           // journal_commit calls (fsyncs)
+    uint64_t flushes = 0;           // group commits, each one data sync and one journal fdatasync
+    uint64_t bytes = 0;             // journal bytes written
+    uint64_t checkpoints = 0;
+};
+
+bool journal_enabled = false;
+uint64_t journal_size_limit = (uint64_t)JOURNAL_DEFAULT_SIZE * 1024 * 1024;
+int journal_fh = -1;
+uint64_t journal_file_size = 0;         // valid bytes in the journal file
+std::string journal_pending;            // records not written yet
+uint64_t journal_appended = 0;          // bytes ever appended to the log
+uint64_t journal_durable = 0;           // bytes of the log that are durable
+bool journal_flushing = false;          // a leader is writing the log
+journal_stat journal_stats;
+bool journal_track_data = false;        // data files are synced by the journal (journal or zoned storage)
+std::unordered_set<int> journal_dirty_fhs;          // data files written since the last commit
+std::vector<int> journal_closed_fhs;                // released dirty files, closed once synced
+std::unordered_set<std::string> journal_dirty_dirs; // directories with new entries since the last commit
+std::mutex journal_dirty_mutex;         // the lock for the dirty files and directories
+std::vector<journal_group_entry> journal_groups;            // journal id -> group
+std::unordered_map<GROUP_ID_TYPE, uint32_t> journal_group_ids;
+std::mutex journal_mutex;               // the lock for the log and group ids
+std::condition_variable journal_cond;   // signaled when a group commit ends
+std::shared_mutex journal_checkpoint_mutex;     // shared by metadata updates, unique while checkpointing
+
+inline std::string journal_path(const char *name){
+    return std::string(JOURNAL_PATH) + "/" + name;
+}
+
+static inline uint32_t journal_checksum(uint8_t type, const char *payload, uint16_t length){
+    uint32_t h = 2166136261u ^ type ^ (length << 8);
+    for (uint16_t i = 0; i < length; i++) h = (h ^ (uint8_t)payload[i]) * 16777619u;
+    return h;
+}
+
+// encode one record into out
+inline void journal_put(std::string &out, uint8_t type, const void *payload, uint16_t length){
+    journal_header header = {journal_checksum(type, (const char *)payload, length), type, length};
+    out.append((const char *)&header, sizeof(header));
+    out.append((const char *)payload, length);
+}
+
+// append one record to the log, journal_mutex must be held
+static inline void journal_append_locked(uint8_t type, const void *payload, uint16_t length){
+    size_t old_size = journal_pending.size();
+    journal_put(journal_pending, type, payload, length);
+    journal_appended += journal_pending.size() - old_size;
+    journal_stats.records++;
+}
+
+static inline uint32_t journal_id_locked(GROUP_ID_TYPE group){
+    if (group == NO_GROUP) return JOURNAL_NO_ID;
+    auto it = journal_group_ids.find(group);
+    return it == journal_group_ids.end() ? JOURNAL_NO_ID : it->second;
+}
+
+inline journal_group_record journal_group_of(group_addr *group, uint32_t id, uint32_t base_id, const char *fp){
+    journal_group_record record = {id, base_id, group->iNum, group->start_byte, group->group_length, group->stored_length, group->compress_type, {}};
+    memcpy(record.fp, fp, SHA_DIGEST_LENGTH);
+    return record;
+}
+
+// encode the binding of iNum to path into out
+inline void journal_put_file(std::string &out, INUM_TYPE iNum, const PATH_TYPE &path){
+    char payload[sizeof(journal_file_record) + PATH_MAX];
+    journal_file_record record = {(uint32_t)iNum};
+    size_t path_len = std::min(path.size(), (size_t)PATH_MAX);
+    memcpy(payload, &record, sizeof(record));
+    memcpy(payload + sizeof(record), path.data(), path_len);
+    journal_put(out, JOURNAL_FILE, payload, sizeof(record) + path_len);
+}
+
+inline void journal_log_file(INUM_TYPE iNum, const PATH_TYPE &path){
+    if (!journal_enabled) return;
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    size_t old_size = journal_pending.size();
+    journal_put_file(journal_pending, iNum, path);
+    journal_appended += journal_pending.size() - old_size;
+    journal_stats.records++;
+}
+
+inline void journal_log_unlink(INUM_TYPE iNum){
+    if (!journal_enabled) return;
+    journal_file_record record = {(uint32_t)iNum};
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    journal_append_locked(JOURNAL_UNLINK, &record, sizeof(record));
+}
+
+// new unique groups of a batch, after their data is written
+inline void journal_log_groups(const GROUP_ID_TYPE *groups, const FP_TYPE *fps, size_t num){
+    if (!journal_enabled) return;
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    for (size_t i = 0; i < num; i++){
+        uint32_t id = journal_groups.size();
+        journal_group_entry entry = {groups[i], {}};
+        memcpy(entry.fp, fps[i].data(), SHA_DIGEST_LENGTH);
+        journal_groups.push_back(entry);
+        journal_group_ids[groups[i]] = id;
+        journal_group_record record = journal_group_of(group_of(groups[i]), id, journal_id_locked(group_of(groups[i])->delta_base), entry.fp);
+        journal_append_locked(JOURNAL_GROUP, &record, sizeof(record));
+    }
+}
+
+// the extents a batch mapped in iNum, one lock for the whole batch
+inline void journal_log_extents(INUM_TYPE iNum, const journal_extent *extents, size_t num){
+    if (!journal_enabled) return;
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    for (size_t i = 0; i < num; i++){
+        journal_map_record record = {(uint32_t)iNum, journal_id_locked(extents[i].group), (uint64_t)extents[i].offset, extents[i].length};
+        journal_append_locked(JOURNAL_MAP, &record, sizeof(record));
+    }
+}
+
+inline void journal_log_move(GROUP_ID_TYPE group){
+    if (!journal_enabled) return;
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    journal_move_record record = {journal_id_locked(group), group_of(group)->iNum, group_of(group)->start_byte};
+    journal_append_locked(JOURNAL_MOVE, &record, sizeof(record));
+}
+
+inline void journal_log_zone(uint32_t zone, uint64_t wp){
+    if (!journal_enabled) return;
+    journal_zone_record record = {zone, wp};
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    journal_append_locked(JOURNAL_ZONE, &record, sizeof(record));
+}
+
+// forget swept groups (dead[id] set), their handles are about to be recycled. they are dead, so no later record
+// refers to their journal id
+inline void journal_forget_groups(const std::vector<bool> &dead){
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    for (journal_group_entry &entry : journal_groups){
+        if (entry.group >= dead.size() || !dead[entry.group]) continue;
+        journal_group_ids.erase(entry.group);
+        entry.group = NO_GROUP;
+    }
+}
+
+// group data was written to fh, the next commit syncs it. call it before logging the records of that data
+inline void journal_mark_data(int fh){
+    if (!journal_track_data) return;
+    std::lock_guard<std::mutex> dirty_lock(journal_dirty_mutex);
+    journal_dirty_fhs.insert(fh);
+}
+
+// a data file was created under dir, the next commit syncs the directory entry
+inline void journal_mark_dir(const std::string &dir){
+    if (!journal_track_data) return;
+    std::lock_guard<std::mutex> dirty_lock(journal_dirty_mutex);
+    journal_dirty_dirs.insert(dir);
+}
+
+// close a data file. a file with unsynced data stays open (so its number isn't reused) until the next commit
+// syncs it, unless JOURNAL_MAX_CLOSED files already wait. return 0 or -1 like close
+inline int journal_close_data(int fh){
+    std::unique_lock<std::mutex> dirty_lock(journal_dirty_mutex);
+    auto it = journal_dirty_fhs.find(fh);
+    if (it == journal_dirty_fhs.end()){
+        dirty_lock.unlock();
+        return close(fh);
+    }
+    if (journal_closed_fhs.size() < JOURNAL_MAX_CLOSED){
+        journal_closed_fhs.push_back(fh);
+        return 0;
+    }
+    journal_dirty_fhs.erase(it);
+    dirty_lock.unlock();
+    int res = fdatasync(fh);
+    if (close(fh) == -1) res = -1;
+    return res;
+}
+
+// flush the group data written so far to the devices: one fdatasync per data file written and one fsync per
+// directory with new files since the last call. return 0 or -errno
+inline int journal_sync_data(){
+    std::unordered_set<int> fhs;
+    std::vector<int> closed;
+    std::unordered_set<std::string> dirs;
+    std::unique_lock<std::mutex> dirty_lock(journal_dirty_mutex);
+    fhs.swap(journal_dirty_fhs);
+    closed.swap(journal_closed_fhs);
+    dirs.swap(journal_dirty_dirs);
+    dirty_lock.unlock();
+    int res = 0;
+    for (int fh : fhs){
+        if (res == 0 && fdatasync(fh) == -1) res = -errno;
+    }
+    for (const std::string &dir : dirs){
+        int dir_fh = res == 0 ? open(dir.c_str(), O_RDONLY | O_DIRECTORY) : -1;
+        if (res == 0 && dir_fh == -1) res = -errno;
+        if (dir_fh == -1) continue;
+        if (fsync(dir_fh) == -1) res = -errno;
+        close(dir_fh);
+    }
+    if (res != 0){      // keep everything for the next try
+        dirty_lock.lock();
+        journal_dirty_fhs.insert(fhs.begin(), fhs.end());
+        journal_closed_fhs.insert(journal_closed_fhs.end(), closed.begin(), closed.end());
+        journal_dirty_dirs.insert(dirs.begin(), dirs.end());
+        return res;
+    }
+    for (int fh : closed) close(fh);
+    return 0;
+}
+
+// the group data the records refer to first, then the records
+static inline int journal_write(const std::string &records, uint64_t offset){
+    int res = journal_sync_data();
+    if (res != 0) return res;
+    for (size_t done = 0; done < records.size(); ){
+        ssize_t written = pwrite(journal_fh, records.data() + done, records.size() - done, offset + done);
+        if (written <= 0) return written == -1 ? -errno : -EIO;
+        done += written;
+    }
+    if (fdatasync(journal_fh) == -1) return -errno;
+    return 0;
+}
+
+// make every record appended so far durable. the first caller writes the log for everyone waiting meanwhile
+// (group commit). return 0 or -errno
+inline int journal_commit(){
+    std::unique_lock<std::mutex> journal_lock(journal_mutex);
+    journal_stats.commits++;
+    uint64_t target = journal_appended;
+    while (journal_durable < target){
+        if (journal_flushing){      // the leader flushes an older part of the log, the next flush covers ours
+            journal_cond.wait(journal_lock);
+            continue;
+        }
+        journal_flushing = true;
+        std::string records;
+        records.swap(journal_pending);
+        uint64_t end = journal_appended, offset = journal_file_size;
+        journal_lock.unlock();
+        int res = journal_write(records, offset);
+        journal_lock.lock();
+        journal_flushing = false;
+        if (res == 0){
+            journal_durable = end;
+            journal_file_size += records.size();
+            journal_stats.flushes++;
+            journal_stats.bytes += records.size();
+        }
+        else journal_pending.insert(0, records);    // keep them for the next try
+        journal_cond.notify_all();
+        if (res != 0){
+            PRINT_WARNING("journal commit failed!!");
+            return res;
+        }
+    }
+    return 0;
+}
+
+// the journal is past journal_size, a checkpoint should empty it
+inline bool journal_want_checkpoint(){
+    if (!journal_enabled) return false;
+    std::lock_guard<std::mutex> journal_lock(journal_mutex);
+    return journal_file_size + journal_pending.size() > journal_size_limit;
+}
+
+// replace the checkpoint by records (the whole metadata, groups renumbered in entries) and empty the journal.
+// the caller holds journal_checkpoint_mutex unique, so nothing is appended meanwhile. return 0 or -errno
+inline int journal_write_checkpoint(const std::string &records, std::vector<journal_group_entry> &entries){
+    std::unique_lock<std::mutex> journal_lock(journal_mutex);
+    journal_cond.wait(journal_lock, []{ return !journal_flushing; });
+    journal_flushing = true;
+    journal_lock.unlock();
+    std::string tmp_path = journal_path("checkpoint.tmp");
+    int res = journal_sync_data();
+    int fh = res == 0 ? open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (res == 0 && fh == -1) res = -errno;
+    if (fh != -1){
+        for (size_t done = 0; res == 0 && done < records.size(); ){
+            ssize_t written = write(fh, records.data() + done, records.size() - done);
+            if (written <= 0) res = written == -1 ? -errno : -EIO;
+            else done += written;
+        }
+        if (res == 0 && fsync(fh) == -1) res = -errno;
+        close(fh);
+    }
+    if (res == 0 && rename(tmp_path.c_str(), journal_path("checkpoint").c_str()) == -1) res = -errno;
+    if (res == 0){
+        int dir_fh = open(JOURNAL_PATH, O_RDONLY | O_DIRECTORY);
+        if (dir_fh != -1){
+            fsync(dir_fh);
+            close(dir_fh);
+        }
+        if (ftruncate(journal_fh, 0) == -1 || fdatasync(journal_fh) == -1) res = -errno;
+    }
+    journal_lock.lock();
+    journal_flushing = false;
+    if (res == 0){
+        journal_file_size = 0;
+        journal_pending.clear();
+        journal_durable = journal_appended;
+        journal_groups.swap(entries);
+        journal_group_ids.clear();
+        for (uint32_t id = 0; id < journal_groups.size(); id++) journal_group_ids[journal_groups[id].group] = id;
+        journal_stats.checkpoints++;
+        journal_stats.bytes += records.size();
+    }
+    else PRINT_WARNING("journal checkpoint failed!!");
+    journal_cond.notify_all();
+    return res;
+}
+
+// call fn(type, payload, length) for every valid record of the file name under JOURNAL_PATH, stopping at the
+// first torn or corrupted one. return the bytes of valid records
+template <typename F>
+inline uint64_t journal_read(const char *name, F fn){
+    int fh = open(journal_path(name).c_str(), O_RDONLY);
+    if (fh == -1) return 0;
+    std::string data;
+    char buf[1 << 16];
+    for (ssize_t res; (res = read(fh, buf, sizeof(buf))) > 0; ) data.append(buf, res);
+    close(fh);
+    uint64_t pos = 0;
+    while (pos + sizeof(journal_header) <= data.size()){
+        journal_header header;
+        memcpy(&header, data.data() + pos, sizeof(header));
+        const char *payload = data.data() + pos + sizeof(header);
+        if (pos + sizeof(header) + header.length > data.size()) break;
+        if (header.checksum != journal_checksum(header.type, payload, header.length)) break;
+        fn(header.type, payload, header.length);
+        pos += sizeof(header) + header.length;
+    }
+    return pos;
+}
+
+// open the journal under JOURNAL_PATH, emptied unless recover is set. group data lives under BACKEND and,
+// with zoned storage, the zone_dirs of every device. Written data files are tracked with journal or zoned storage,
+// so fsync can sync only them, the data directories are synced by the first commit. return -1 if something can't
+// be opened
+inline int journal_init(bool enabled, uint32_t size_mb, const std::vector<std::string> &zone_dirs, bool recover){
+    journal_enabled = enabled;
+    journal_size_limit = (uint64_t)size_mb * 1024 * 1024;
+    journal_track_data = enabled || !zone_dirs.empty();
+    std::vector<std::string> dirs = {BACKEND};
+    dirs.insert(dirs.end(), zone_dirs.begin(), zone_dirs.end());
+    std::error_code ec;
+    for (const std::string &dir : dirs){
+        if (!std::filesystem::is_directory(dir, ec)) return -1;
+        journal_mark_dir(dir);
+    }
+    if (!enabled) return 0;
+    std::filesystem::create_directories(JOURNAL_PATH, ec);
+    if (!recover) std::filesystem::remove(journal_path("checkpoint"), ec);
+    journal_fh = open(journal_path("journal").c_str(), O_RDWR | O_CREAT | (recover ? 0 : O_TRUNC), 0644);
+    return journal_fh == -1 ? -1 : 0;
+}
+
+#endif /* JOURNAL_H */
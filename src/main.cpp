@@ -9,6 +9,44 @@ static void cdcfs_leave(void *param){
     PRINT_MESSAGE("\n----------------------------------------leaving CDCFS !!!----------------------------------------");
     PRINT_MESSAGE("total write size:" << (float)total_write_size / 1000000000 << "GB");
     PRINT_MESSAGE("total dedup rate:" << (float)total_dedup_size / total_write_size * 100 << "%");
+    PRINT_MESSAGE("total compress saving:" << (float)total_compress_saving / 1000000000 << "GB");
+    PRINT_MESSAGE("total delta saving:" << (float)total_delta_saving / 1000000000 << "GB");
+    PRINT_MESSAGE("group table: " << group_table_size() << " groups, " << (float)group_table_memory() / 1000000 << "MB");
+    PRINT_MESSAGE("fingerprint index: " << fp_index_name(index_mode) << " unique: " << fp_index_size()
+                  << " memory: " << (float)fp_index_memory() / 1000000 << "MB");
+    if (storage_mode == STORAGE_ZONE){
+        uint32_t used_zones;
+        uint64_t written, live;
+        zone_usage(&used_zones, &written, &live);
+        PRINT_MESSAGE("zones used: " << used_zones << "/" << zones.size() << " utilization: " << (written ? (float)live / written * 100 : 0) << "%"
+                      << " resets: " << zone_stats.resets << " migrated: " << (float)zone_stats.migrated / 1000000 << "MB");
+        for (uint32_t d = 0; d < zone_device_num; d++){
+            PRINT_MESSAGE("device " << zone_devices[d].root << " written: " << (float)zone_devices[d].written / 1000000 << "MB"
+                          << " read: " << (float)zone_devices[d].read / 1000000 << "MB");
+        }
+    }
+    if (journal_enabled){
+        journal_checkpoint();   // a clean unmount recovers from the checkpoint alone
+        PRINT_MESSAGE("journal: fsyncs: " << journal_stats.commits << " group commits: " << journal_stats.flushes
+                      << " records: " << journal_stats.records << " written: " << (float)journal_stats.bytes / 1000000 << "MB"
+                      << " checkpoints: " << journal_stats.checkpoints);
+    }
+    if (rewrite_cap > 0){
+        uint64_t size = 0, runs = 0;
+        for (const auto &[file_path, iNum] : path_to_iNum){
+            cdcfs_frag frag = file_fragmentation(iNum);
+            size += frag.size;
+            runs += frag.runs;
+        }
+        PRINT_MESSAGE("rewrite: groups: " << rewrite_stats.groups << " size: " << (float)rewrite_stats.bytes / 1000000 << "MB"
+                      << " runs per MB: " << (size ? (float)runs / size * 1000000 : 0));
+    }
+    if (index_mode != INDEX_MEMORY){
+        PRINT_MESSAGE("  lookups: " << index_stat.lookups << " cache hits: " << index_stat.cache_hits + index_stat.open_hits
+                      << " bloom skips: " << index_stat.bloom_skips << " disk lookups: " << index_stat.disk_lookups
+                      << " false positives: " << index_stat.false_positives << " segment loads: " << index_stat.segment_loads
+                      << " hook lookups: " << index_stat.hook_lookups);
+    }
     // output the mapping table to a file
     #ifdef MAPPING_OUTPUT_PATH
         std::ofstream mapping_output(MAPPING_OUTPUT_PATH);
@@ -16,11 +54,18 @@ static void cdcfs_leave(void *param){
             mapping_output << "file: " << file_path << std::endl;
             mapping_table_entry *entry = &mapping_table[iNum];
             for (uint64_t group_id = 0; group_id < (uint64_t)entry->group_pos.size(); group_id++) {
-                if (entry->group_pos[group_id]->iNum == iNum){
-                    mapping_output << "noDedup: " << entry->group_pos[group_id]->start_byte << " " << entry->group_pos[group_id]->group_length << std::endl;
+                group_addr *group = group_of(entry->group_pos[group_id]);
+                if (group->iNum == HOLE_INUM){
+                    mapping_output << "hole: " << entry->group_offset[group_id] << " " << extent_length(entry, group_id) << std::endl;
+                }
+                else if (IS_ZONE_INUM(group->iNum)){
+                    mapping_output << "zone: " << group->iNum - ZONE_INUM(0) << " " << group->start_byte << " " << group->group_length << std::endl;
+                }
+                else if (group->iNum == iNum){
+                    mapping_output << "noDedup: " << group->start_byte << " " << group->group_length << std::endl;
                 }
                 else{
-                    mapping_output << "dedup: " << iNum_to_path[entry->group_pos[group_id]->iNum] << " "<< entry->group_pos[group_id]->start_byte  << " " << entry->group_pos[group_id]->group_length << std::endl;
+                    mapping_output << "dedup: " << iNum_to_path[group->iNum] << " "<< group->start_byte  << " " << group->group_length << std::endl;
                 }
             }
         }
@@ -35,11 +80,76 @@ static void cdcfs_leave(void *param){
     #endif
 }
 
+// CDCFS specific mount options: -o chunker=<engine>,chunk_min=<bytes>,chunk_avg=<bytes>,chunk_max=<bytes>
+//                                  compress=<none|lz4|zstd>,compress_level=<lz4 acceleration|zstd level>
+//                                  delta_depth=<longest delta chain, 0: no delta encoding>
+//                                  index=<memory|locality|sparse>,index_cache=<segments>,index_bloom=<MB>
+//                                  index_sample=<hook bits>,index_champions=<manifests>
+//                                  write_buffer=<bytes>,chunk_threads=<n>
+//                                  storage=<file|zone>,zone_size=<MB>,zone_num=<n>,zone_devices=<dir:dir:...>
+//                                  journal,journal_size=<MB>,recover
+//                                  rewrite_cap=<containers per segment, 0: no rewriting>,rewrite_segment=<MB>,rewrite_limit=<%>
+struct cdcfs_options{
+    const char *chunker = DEFAULT_CHUNKER;
+    unsigned chunk_min = 0;
+    unsigned chunk_avg = BLOCK_SIZE;
+    unsigned chunk_max = MAX_GROUP_SIZE;
+    const char *compress = "none";
+    int compress_level = 1;
+    unsigned delta_depth = 0;
+    const char *index = "memory";
+    unsigned index_cache = INDEX_DEFAULT_CACHE;
+    unsigned index_bloom = INDEX_DEFAULT_BLOOM;
+    unsigned index_sample = INDEX_DEFAULT_SAMPLE;
+    unsigned index_champions = INDEX_DEFAULT_CHAMPIONS;
+    unsigned write_buffer = DEFAULT_WRITE_BUFFER_SIZE;
+    unsigned chunk_threads = 1;
+    const char *storage = "file";
+    unsigned zone_size = ZONE_DEFAULT_SIZE;
+    unsigned zone_num = ZONE_DEFAULT_NUM;
+    const char *zone_devices = "";
+    int journal = 0;
+    unsigned journal_size = JOURNAL_DEFAULT_SIZE;
+    int recover = 0;
+    unsigned rewrite_cap = 0;
+    unsigned rewrite_segment = REWRITE_DEFAULT_SEGMENT;
+    unsigned rewrite_limit = REWRITE_DEFAULT_LIMIT;
+};
+
+#define CDCFS_OPT(t, p) { t, offsetof(struct cdcfs_options, p), 1 }
+static const struct fuse_opt cdcfs_opts[] = {
+    CDCFS_OPT("chunker=%s", chunker),
+    CDCFS_OPT("chunk_min=%u", chunk_min),
+    CDCFS_OPT("chunk_avg=%u", chunk_avg),
+    CDCFS_OPT("chunk_max=%u", chunk_max),
+    CDCFS_OPT("compress=%s", compress),
+    CDCFS_OPT("compress_level=%d", compress_level),
+    CDCFS_OPT("delta_depth=%u", delta_depth),
+    CDCFS_OPT("index=%s", index),
+    CDCFS_OPT("index_cache=%u", index_cache),
+    CDCFS_OPT("index_bloom=%u", index_bloom),
+    CDCFS_OPT("index_sample=%u", index_sample),
+    CDCFS_OPT("index_champions=%u", index_champions),
+    CDCFS_OPT("write_buffer=%u", write_buffer),
+    CDCFS_OPT("chunk_threads=%u", chunk_threads),
+    CDCFS_OPT("storage=%s", storage),
+    CDCFS_OPT("zone_size=%u", zone_size),
+    CDCFS_OPT("zone_num=%u", zone_num),
+    CDCFS_OPT("zone_devices=%s", zone_devices),
+    CDCFS_OPT("journal", journal),
+    CDCFS_OPT("journal_size=%u", journal_size),
+    CDCFS_OPT("recover", recover),
+    CDCFS_OPT("rewrite_cap=%u", rewrite_cap),
+    CDCFS_OPT("rewrite_segment=%u", rewrite_segment),
+    CDCFS_OPT("rewrite_limit=%u", rewrite_limit),
+    FUSE_OPT_END
+};
+
 static struct fuse_operations cdcfs_oper = {
     .getattr        = cdcfs_getattr,
     .readlink       = cdcfs_readlink,
     .mkdir          = cdcfs_mkdir,
-    //.unlink         = cdcfs_unlink,
+    .unlink         = cdcfs_unlink,
     .rmdir          = cdcfs_rmdir,
     .symlink        = cdcfs_symlink,
     .link           = cdcfs_link,
@@ -49,19 +159,50 @@ static struct fuse_operations cdcfs_oper = {
     .read           = cdcfs_read,
     .write          = cdcfs_write,
     .release        = cdcfs_release,
+    .fsync          = cdcfs_fsync,
     .opendir        = cdcfs_opendir,
     .readdir        = cdcfs_readdir,
     .releasedir     = cdcfs_releasedir,
     .destroy        = cdcfs_leave,
     .create         = cdcfs_create,
     .ftruncate      = cdcfs_ftruncate,
+    .ioctl          = cdcfs_ioctl,
 };
 
 int main(int argc, char *argv[]) {
-    // remove every file in backend directory.
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    cdcfs_options options;
+    if (fuse_opt_parse(&args, &options, cdcfs_opts, NULL) == -1) return 1;
+    if (options.chunk_max > MAX_GROUP_SIZE || options.chunk_min > options.chunk_avg || options.chunk_avg > options.chunk_max){
+        PRINT_WARNING("chunk size must satisfy chunk_min <= chunk_avg <= chunk_max <= " << MAX_GROUP_SIZE);
+        return 1;
+    }
+    if (options.write_buffer < MAX_GROUP_SIZE || options.write_buffer > MAX_WRITE_BUFFER_SIZE){
+        PRINT_WARNING("write_buffer must be between " << MAX_GROUP_SIZE << " and " << MAX_WRITE_BUFFER_SIZE);
+        return 1;
+    }
+    if (options.chunk_threads == 0 || options.chunk_threads > MAX_CHUNK_THREADS){
+        PRINT_WARNING("chunk_threads must be between 1 and " << MAX_CHUNK_THREADS);
+        return 1;
+    }
+    if (options.zone_size == 0 || options.zone_size > ZONE_MAX_SIZE){
+        PRINT_WARNING("zone_size must be between 1 and " << ZONE_MAX_SIZE << " MB");
+        return 1;
+    }
+    if (options.journal_size == 0 || options.journal_size > JOURNAL_MAX_SIZE){
+        PRINT_WARNING("journal_size must be between 1 and " << JOURNAL_MAX_SIZE << " MB");
+        return 1;
+    }
+    if (options.rewrite_segment == 0 || options.rewrite_segment > REWRITE_MAX_SEGMENT || options.rewrite_limit > 100){
+        PRINT_WARNING("rewrite_segment must be between 1 and " << REWRITE_MAX_SEGMENT << " MB and rewrite_limit at most 100%");
+        return 1;
+    }
+    if (options.recover) options.journal = 1;
+    // remove every file in backend directory, unless its metadata is recovered from the journal
     bool show_confirm = false;
     char replay;
     for (const auto& entry : std::filesystem::directory_iterator(BACKEND)){
+        if (options.recover) break;
         if (!show_confirm){
             std::cout << "WARNING: BACKEND directory is not empty, all files in it will be removed!![y|n]";
             std::cin >> replay;
@@ -72,15 +213,74 @@ int main(int argc, char *argv[]) {
     }
     // init CDCFS data structure
     PRINT_MESSAGE("----------------------------------------entering CDCFS !!----------------------------------------");
-    for (INUM_TYPE iNum = 0; iNum < MAX_INODE_NUM - 1; ++iNum) {
-        free_iNum.insert(iNum);
+    cdcfs_init_status();
+    if (chunker_init(&cdc_chunker, options.chunker, options.chunk_min, options.chunk_avg, options.chunk_max) == -1){
+        PRINT_WARNING("unknown chunker: " << options.chunker);
+        return 1;
+    }
+    int compress_type = compress_type_of(options.compress);
+    if (compress_type == -1){
+        PRINT_WARNING("unsupported compression: " << options.compress << " (build with \"make Compress\" for lz4/zstd)");
+        return 1;
+    }
+    group_compress_type = compress_type;
+    group_compress_level = options.compress_level;
+    PRINT_MESSAGE("compress: " << compress_name(group_compress_type) << " level: " << group_compress_level);
+    if (options.delta_depth > DELTA_MAX_DEPTH){
+        PRINT_WARNING("delta_depth can not exceed " << DELTA_MAX_DEPTH);
+        return 1;
+    }
+    delta_max_depth = options.delta_depth;
+    PRINT_MESSAGE("delta depth: " << (int)delta_max_depth);
+    int mode = fp_index_mode_of(options.index);
+    if (mode == -1){
+        PRINT_WARNING("unknown index: " << options.index);
+        return 1;
+    }
+    if (options.index_sample > INDEX_MAX_SAMPLE){
+        PRINT_WARNING("index_sample can not exceed " << INDEX_MAX_SAMPLE);
+        return 1;
+    }
+    if (fp_index_init(mode, options.index_cache, options.index_bloom, options.index_sample, options.index_champions) == -1){
+        PRINT_WARNING("can't create fingerprint index in " << INDEX_PATH);
+        return 1;
+    }
+    PRINT_MESSAGE("index: " << fp_index_name(index_mode) << " cache: " << index_cache_segments << " segments"
+                  << " sample: 1/" << index_sample_mask + 1 << " champions: " << index_champion_num);
+    int storage = storage_mode_of(options.storage);
+    if (storage == -1){
+        PRINT_WARNING("unknown storage: " << options.storage);
+        return 1;
+    }
+    std::vector<std::string> device_roots;
+    if (!zone_parse_devices(options.zone_devices, device_roots) || (!device_roots.empty() && storage != STORAGE_ZONE)){
+        PRINT_WARNING("zone_devices needs storage=zone and at most " << ZONE_MAX_DEVICES << " directories");
+        return 1;
+    }
+    if (zone_init(storage, options.zone_size, options.zone_num, options.recover, device_roots) == -1){
+        PRINT_WARNING("can't create zones in " << (device_roots.empty() ? ZONE_PATH : options.zone_devices));
+        return 1;
+    }
+    PRINT_MESSAGE("storage: " << storage_name(storage_mode) << (storage_mode == STORAGE_ZONE ? " zones: " + std::to_string(zones.size()) + " x " + std::to_string(options.zone_size) + "MB"
+                  + " devices: " + std::to_string(zone_device_num) : ""));
+    if (journal_init(options.journal, options.journal_size, zone_device_roots(), options.recover) == -1){
+        PRINT_WARNING("can't open the journal in " << JOURNAL_PATH);
+        return 1;
     }
-    for(FILE_HANDLER_INDEX_TYPE file_handler = 0; file_handler < MAX_FILE_HANDLER - 1; ++file_handler){
-        free_file_handler.insert(file_handler);
+    PRINT_MESSAGE("journal: " << (journal_enabled ? "on" : "off") << " checkpoint every: " << options.journal_size << "MB");
+    if (options.recover){
+        uint64_t records = journal_recover();
+        PRINT_MESSAGE("recovered " << path_to_iNum.size() << " files from " << records << " journal records");
     }
-    // init fastcdc engine
-    cdc = fastcdc_init(0, BLOCK_SIZE, MAX_GROUP_SIZE);
-    ctx = &cdc;
+    rewrite_init(options.rewrite_cap, options.rewrite_segment, options.rewrite_limit);
+    PRINT_MESSAGE("rewrite: cap: " << rewrite_cap << " containers per " << options.rewrite_segment << "MB limit: " << rewrite_limit << "%");
+    write_buffer_size = fp_index_write_buffer(options.write_buffer);
+    chunk_threads = options.chunk_threads;
+    PRINT_MESSAGE("write buffer: " << write_buffer_size << " chunk threads: " << chunk_threads);
+    PRINT_MESSAGE("chunker: " << cdc_chunker.name << " min: " << cdc_chunker.param.mi << " avg: " << cdc_chunker.param.av
+                  << " max: " << cdc_chunker.param.ma);
     // start CDCFS
-    return fuse_main(argc, argv, &cdcfs_oper, NULL);
+    int res = fuse_main(args.argc, args.argv, &cdcfs_oper, NULL);
+    fuse_opt_free_args(&args);
+    return res;
 }
\ No newline at end of file
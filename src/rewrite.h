@@ -0,0 +1,101 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include "def.h"
+#include "group_table.h"
+
+// Fragmentation-aware rewriting, capping (Lillibridge et al.). cdcfs_read opens and reads every backend file (zone
+// in zone storage) a file dedups against, so the more "containers" the groups of a file are scattered over, the
+// slower it is read back, and it gets worse with every backup generation.
+// The stream of a writing handler is cut into segments of rewrite_segment bytes, and the duplicates of a segment may
+// come from rewrite_cap containers at most: the containers giving a batch the most bytes are kept, the duplicates
+// from the others are stored again next to the new data of the file. The rewritten copy replaces the old one in the
+// fingerprint index, so the next generations dedup against it. Rewritten bytes never exceed rewrite_limit percent
+// of the bytes written, which caps the dedup ratio given up for read speed.
+
+#define REWRITE_DEFAULT_SEGMENT 4   // MB of stream per segment
+#define REWRITE_MAX_SEGMENT 1024
+#define REWRITE_DEFAULT_LIMIT 5     // percent of the written bytes
+
+struct rewrite_stream{
+    uint64_t bytes = 0;                         // bytes of the current segment
+    std::unordered_set<INUM_TYPE> containers;   // containers the current segment dedups against
+};
+
+struct rewrite_stat{
+    uint64_t groups = 0;    // duplicates stored again
+    uint64_t bytes = 0;
+};
+
+uint32_t rewrite_cap = 0;   // containers per segment, 0: no rewriting
+uint64_t rewrite_segment = (uint64_t)REWRITE_DEFAULT_SEGMENT * 1024 * 1024;
+uint32_t rewrite_limit = REWRITE_DEFAULT_LIMIT;
+rewrite_stream rewrite_streams[MAX_FILE_HANDLER];
+rewrite_stat rewrite_stats;
+std::mutex rewrite_mutex;   // the lock for rewrite_stats, the budget of every stream
+
+inline void rewrite_init(uint32_t cap, uint32_t segment_mb, uint32_t limit){
+    rewrite_cap = cap;
+    rewrite_segment = (uint64_t)std::min(std::max(segment_mb, 1U), (uint32_t)REWRITE_MAX_SEGMENT) * 1024 * 1024;
+    rewrite_limit = std::min(limit, 100U);
+}
+
+// a new stream starts on the handler
+inline void rewrite_reset_stream(FILE_HANDLER_INDEX_TYPE stream_idx){
+    rewrite_streams[stream_idx] = rewrite_stream();
+}
+
+// pick the duplicates of a batch to store again. found[i] is the group chunk i of length[i] bytes dedups against
+// (NO_GROUP: unique), rewritten chunks get found[i] = NO_GROUP and rewritten[i] = true. own is the backend file of
+// the stream itself, which is read anyway, written the bytes written so far including this batch.
+// return the number of chunks rewritten
+inline size_t rewrite_select(FILE_HANDLER_INDEX_TYPE stream_idx, INUM_TYPE own, GROUP_ID_TYPE *found, const uint32_t *length,
+                             size_t num, uint64_t written, std::vector<bool> &rewritten){
+    rewritten.assign(num, false);
+    if (rewrite_cap == 0) return 0;
+    rewrite_stream *stream = &rewrite_streams[stream_idx];
+    if (stream->bytes >= rewrite_segment){
+        stream->bytes = 0;
+        stream->containers.clear();
+    }
+    std::unordered_map<INUM_TYPE, uint64_t> candidate;     // container not used by the segment yet -> its bytes in this batch
+    for (size_t i = 0; i < num; i++){
+        stream->bytes += length[i];
+        if (found[i] == NO_GROUP) continue;
+        INUM_TYPE container = group_of(found[i])->iNum;
+        if (container == own || stream->containers.count(container)) continue;
+        candidate[container] += length[i];
+    }
+    if (candidate.empty()) return 0;
+    std::vector<std::pair<uint64_t, INUM_TYPE>> order;
+    for (const auto &[container, bytes] : candidate) order.push_back({bytes, container});
+    std::sort(order.begin(), order.end(), std::greater<std::pair<uint64_t, INUM_TYPE>>());
+    // keep the biggest containers while the cap allows, rewrite the others while the budget allows
+    std::unordered_set<INUM_TYPE> victims;
+    std::lock_guard<std::mutex> rewrite_lock(rewrite_mutex);
+    for (const auto &[bytes, container] : order){
+        if (stream->containers.size() < rewrite_cap || (rewrite_stats.bytes + bytes) * 100 > rewrite_limit * written){
+            stream->containers.insert(container);
+            continue;
+        }
+        victims.insert(container);
+        rewrite_stats.bytes += bytes;
+    }
+    size_t rewritten_num = 0;
+    for (size_t i = 0; i < num; i++){
+        if (found[i] == NO_GROUP || !victims.count(group_of(found[i])->iNum)) continue;
+        found[i] = NO_GROUP;
+        rewritten[i] = true;
+        rewritten_num++;
+    }
+    rewrite_stats.groups += rewritten_num;
+    return rewritten_num;
+}
+
+#endif /* REWRITE_H */
@@ -0,0 +1,438 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include "def.h"
+#include "compress.h"
+#include "group_table.h"
+#include "journal.h"
+
+// Storage of unique groups.
+// "file": a group is written at the end of the backend file of the file that stored it first.
+// "zone": groups are appended sequentially into zones of a ZNS style device, emulated by one file per zone under
+// ZONE_PATH. A group in zone z has iNum ZONE_INUM(z) and start_byte is its offset in the zone, so the read path
+// just opens the zone file. Space is reserved at the write pointer of the open zone, which is what zone append
+// does on real hardware. Groups of deleted files leave garbage in their zones, a zone is reclaimed by moving its
+// live groups to the open zone (their group_addr is updated in place) and resetting it, its dead groups are buried.
+// Zones can be striped over several devices (one directory per NVMe drive, "-o zone_devices="): zone z lives on
+// device z % device_num and every device appends into an open zone of its own. A batch is cut into stripe units,
+// each placed on the device with the most room per io in flight, and the io of different devices is issued in
+// parallel by writes and reads alike.
+
+#define STORAGE_FILE 0
+#define STORAGE_ZONE 1
+
+#define ZONE_EMPTY 0
+#define ZONE_OPEN 1
+#define ZONE_FULL 2
+
+#define ZONE_DEFAULT_SIZE 256       // MB
+#define ZONE_MAX_SIZE 4095          // MB, start_byte is 32 bits
+#define ZONE_DEFAULT_NUM 64
+#define ZONE_GC_RESERVE 1           // empty zones only reclaim may open
+#define ZONE_MAX_DEVICES 16
+#define ZONE_STRIPE_UNIT (1024 * 1024)     // bytes of a batch placed on one device before the next one is picked
+#define ZONE_PARALLEL_MIN (256 * 1024)      // io bytes of a device worth a thread of its own
+#define ZONE_INUM(zone) ((INUM_TYPE)MAX_INODE_NUM + (zone))
+#define IS_ZONE_INUM(iNum) ((iNum) >= (INUM_TYPE)MAX_INODE_NUM && (iNum) < FREED_INUM)
+
+struct zone_info{
+    uint8_t cond = ZONE_EMPTY;
+    uint8_t device = 0;                     // the device holding its emulator file
+    uint64_t wp = 0;                        // write pointer, bytes from the zone start
+    uint64_t live = 0;                      // bytes of groups still referenced
+    int fh = -1;                            // emulator file
+    std::vector<GROUP_ID_TYPE> groups;      // every group appended since the last reset
+};
+
+struct zone_stat{
+    uint64_t resets = 0;                    // zones reclaimed
+    uint64_t migrated = 0;                  // bytes of live groups moved by reclaim
+    uint64_t freed = 0;                     // bytes of dead groups dropped by reclaim
+};
+
+struct zone_device{
+    std::string root;                       // directory of its zone files
+    int open_idx = -1;                      // the zone being appended to
+    std::atomic<uint32_t> inflight{0};      // io being issued to it (queue depth)
+    std::atomic<uint64_t> written{0};       // bytes
+    std::atomic<uint64_t> read{0};
+};
+
+struct zone_stripe{
+    int device = -1;                        // the device the current stripe unit goes to
+    uint64_t unit = 0;                      // bytes placed in the current stripe unit
+};
+
+int storage_mode = STORAGE_FILE;
+uint64_t zone_capacity = (uint64_t)ZONE_DEFAULT_SIZE * 1024 * 1024;
+std::vector<zone_info> zones;
+zone_device zone_devices[ZONE_MAX_DEVICES];
+uint32_t zone_device_num = 1;
+zone_stripe zone_stripes[MAX_FILE_HANDLER]; // the stripe unit of every writing handler
+zone_stat zone_stats;
+std::mutex zone_alloc_mutex;                // the lock for write pointers and utilization
+std::shared_mutex zone_reclaim_mutex;       // shared by readers and writers of zones, unique while reclaiming
+
+// return -1 if name is unknown
+inline int storage_mode_of(const char *name){
+    if (strcmp(name, "file") == 0) return STORAGE_FILE;
+    if (strcmp(name, "zone") == 0) return STORAGE_ZONE;
+    return -1;
+}
+
+inline const char *storage_name(int mode){
+    return mode == STORAGE_ZONE ? "zone" : "file";
+}
+
+// pwritev that takes any number of iovecs, return false if not everything is written
+inline bool pwritev_all(int fh, struct iovec *iov, size_t iov_num, off_t offset){
+    for (size_t done = 0; done < iov_num; ){
+        int num = std::min(iov_num - done, (size_t)IOV_MAX);
+        ssize_t len = 0;
+        for (int i = 0; i < num; i++) len += iov[done + i].iov_len;
+        if (pwritev(fh, iov + done, num, offset) != len) return false;
+        offset += len;
+        done += num;
+    }
+    return true;
+}
+
+// split a ':' separated list of device directories, return false if there are too many
+inline bool zone_parse_devices(const char *list, std::vector<std::string> &roots){
+    roots.clear();
+    std::string all(list);
+    for (size_t start = 0, end; start <= all.size(); start = end + 1){
+        end = all.find(':', start);
+        if (end == std::string::npos) end = all.size();
+        if (end > start) roots.push_back(all.substr(start, end - start));
+    }
+    return roots.size() <= ZONE_MAX_DEVICES;
+}
+
+// create zone_num empty zones of size_mb MB, striped over the device directories (ZONE_PATH if none is given).
+// their content is kept if recover is set, the journal rebuilds their state, so a recovery must be given the same
+// devices. return -1 if they can't be created
+inline int zone_init(int mode, uint32_t size_mb, uint32_t zone_num, bool recover, const std::vector<std::string> &roots = {}){
+    storage_mode = mode;
+    if (mode != STORAGE_ZONE) return 0;
+    if (roots.size() > ZONE_MAX_DEVICES) return -1;
+    zone_device_num = roots.empty() ? 1 : roots.size();
+    for (uint32_t d = 0; d < zone_device_num; d++){
+        zone_devices[d].root = roots.empty() ? ZONE_PATH : roots[d];
+        zone_devices[d].open_idx = -1;
+    }
+    zone_capacity = (uint64_t)size_mb * 1024 * 1024;
+    zones.assign(std::max(zone_num, zone_device_num + ZONE_GC_RESERVE), zone_info());
+    for (size_t z = 0; z < zones.size(); z++){
+        zones[z].device = z % zone_device_num;
+        std::error_code ec;
+        std::filesystem::create_directories(zone_devices[zones[z].device].root, ec);
+        std::string path = zone_devices[zones[z].device].root + "/zone_" + std::to_string(z);
+        zones[z].fh = open(path.c_str(), O_RDWR | O_CREAT | (recover ? 0 : O_TRUNC), 0644);
+        if (zones[z].fh == -1) return -1;
+    }
+    return 0;
+}
+
+inline void zone_path(INUM_TYPE iNum, char *full_path, size_t size){
+    size_t z = iNum - ZONE_INUM(0);
+    snprintf(full_path, size, "%s/zone_%lu", zone_devices[zones[z].device].root.c_str(), z);
+}
+
+// the directories holding zone files, none with file storage
+inline std::vector<std::string> zone_device_roots(){
+    std::vector<std::string> roots;
+    for (uint32_t d = 0; storage_mode == STORAGE_ZONE && d < zone_device_num; d++) roots.push_back(zone_devices[d].root);
+    return roots;
+}
+
+// the device of a container, zone_device_num for a backend file (they all share the BACKEND device)
+inline uint32_t zone_device_of(INUM_TYPE iNum){
+    return IS_ZONE_INUM(iNum) ? zones[iNum - ZONE_INUM(0)].device : zone_device_num;
+}
+
+// run fn(d) for every device d with io bytes[d] > 0. when two devices or more have ZONE_PARALLEL_MIN bytes, each of
+// them gets a thread of its own, the rest is served one after another by the caller
+template <typename F>
+inline void zone_parallel(const std::vector<uint64_t> &bytes, F fn){
+    std::vector<uint32_t> heavy, light;
+    for (size_t d = 0; d < bytes.size(); d++){
+        if (bytes[d] == 0) continue;
+        if (bytes[d] >= ZONE_PARALLEL_MIN) heavy.push_back(d);
+        else light.push_back(d);
+    }
+    if (heavy.size() < 2){  // nothing worth overlapping
+        light.insert(light.end(), heavy.begin(), heavy.end());
+        heavy.clear();
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < heavy.size(); i++) threads.emplace_back(fn, heavy[i]);
+    if (!heavy.empty()) fn(heavy[0]);
+    for (uint32_t d : light) fn(d);
+    for (std::thread &thread : threads) thread.join();
+}
+
+// the device can take group_length bytes, in its open zone or a new one
+static bool zone_device_fits(uint32_t d, uint32_t group_length, bool for_reclaim, int empty_num){
+    int open_idx = zone_devices[d].open_idx;
+    if (open_idx != -1 && zones[open_idx].wp + group_length <= zone_capacity) return true;
+    if (!for_reclaim && empty_num <= ZONE_GC_RESERVE) return false;
+    for (const zone_info &zone : zones){
+        if (zone.device == d && zone.cond == ZONE_EMPTY) return true;
+    }
+    return false;
+}
+
+// the device a stripe unit goes to: the one with the most room (empty zones and what is left of its open zone)
+// per io in flight, -1 if no device can take group_length bytes
+static int zone_pick_device(uint32_t group_length, bool for_reclaim){
+    std::vector<uint64_t> room(zone_device_num, 0);
+    int empty_num = 0;
+    for (const zone_info &zone : zones){
+        if (zone.cond != ZONE_EMPTY) continue;
+        room[zone.device] += zone_capacity;
+        empty_num++;
+    }
+    int best = -1;
+    double best_score = 0;
+    for (uint32_t d = 0; d < zone_device_num; d++){
+        if (!zone_device_fits(d, group_length, for_reclaim, empty_num)) continue;
+        if (zone_devices[d].open_idx != -1) room[d] += zone_capacity - zones[zone_devices[d].open_idx].wp;
+        double score = (double)room[d] / (zone_devices[d].inflight + 1);
+        if (best == -1 || score > best_score){
+            best = d;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+// open a new zone on the device if group_length doesn't fit in its open one, return false if it has no zone left
+static bool zone_make_room(uint32_t d, uint32_t group_length, bool for_reclaim){
+    zone_device *device = &zone_devices[d];
+    if (device->open_idx != -1 && zones[device->open_idx].wp + group_length <= zone_capacity) return true;
+    if (device->open_idx != -1) zones[device->open_idx].cond = ZONE_FULL;
+    device->open_idx = -1;
+    int empty_num = 0, empty_idx = -1;
+    for (size_t z = 0; z < zones.size(); z++){
+        if (zones[z].cond != ZONE_EMPTY) continue;
+        if (empty_idx == -1 && zones[z].device == d) empty_idx = z;
+        empty_num++;
+    }
+    if (empty_idx == -1 || (!for_reclaim && empty_num <= ZONE_GC_RESERVE)) return false;
+    device->open_idx = empty_idx;
+    zones[empty_idx].cond = ZONE_OPEN;
+    return true;
+}
+
+// reserve space for groups at the write pointer of open zones (zone append), the stream of stripe moves to a new
+// device every ZONE_STRIPE_UNIT bytes. return how many got a place
+static size_t zone_reserve(const GROUP_ID_TYPE *groups, size_t num, bool for_reclaim, zone_stripe *stripe){
+    std::lock_guard<std::mutex> zone_alloc_lock(zone_alloc_mutex);
+    size_t reserved = 0;
+    for (; reserved < num; reserved++){
+        group_addr *group = group_of(groups[reserved]);
+        int d = stripe->device;
+        if (d == -1 || stripe->unit >= ZONE_STRIPE_UNIT || !zone_make_room(d, group->stored_length, for_reclaim)){
+            d = stripe->device = zone_pick_device(group->stored_length, for_reclaim);
+            stripe->unit = 0;
+            if (d == -1 || !zone_make_room(d, group->stored_length, for_reclaim)) break;
+        }
+        int z = zone_devices[d].open_idx;
+        zone_info *zone = &zones[z];
+        group->iNum = ZONE_INUM(z);
+        group->start_byte = zone->wp;
+        zone->wp += group->stored_length;
+        zone->live += group->stored_length;
+        zone->groups.push_back(groups[reserved]);
+        stripe->unit += group->stored_length;
+    }
+    return reserved;
+}
+
+// write reserved groups, one pwritev per run of groups that are contiguous in a zone, the runs of different devices
+// in parallel
+static bool zone_write_reserved(const GROUP_ID_TYPE *groups, struct iovec *iov, size_t num){
+    std::vector<std::vector<std::pair<size_t, size_t>>> runs(zone_device_num);    // [start, end) runs of every device
+    std::vector<uint64_t> bytes(zone_device_num, 0);
+    for (size_t start = 0, end; start < num; start = end){
+        group_addr *first = group_of(groups[start]);
+        for (end = start + 1; end < num; end++){
+            group_addr *prev = group_of(groups[end - 1]), *cur = group_of(groups[end]);
+            if (cur->iNum != first->iNum) break;
+            if (cur->start_byte != prev->start_byte + prev->stored_length) break;
+        }
+        uint32_t d = zone_device_of(first->iNum);
+        runs[d].push_back({start, end});
+        for (size_t i = start; i < end; i++) bytes[d] += iov[i].iov_len;
+    }
+    std::atomic<bool> ok(true);
+    zone_parallel(bytes, [&](uint32_t d){
+        zone_device *device = &zone_devices[d];
+        for (const auto &[start, end] : runs[d]){
+            group_addr *first = group_of(groups[start]);
+            device->inflight++;
+            bool written = pwritev_all(zones[first->iNum - ZONE_INUM(0)].fh, iov + start, end - start, first->start_byte);
+            device->inflight--;
+            if (!written){
+                ok = false;
+                return;
+            }
+            journal_mark_data(zones[first->iNum - ZONE_INUM(0)].fh);
+        }
+        device->written += bytes[d];
+    });
+    return ok;
+}
+
+// a group lost its last reference, its bytes become garbage of its zone
+inline void zone_release(group_addr *group){
+    if (!IS_ZONE_INUM(group->iNum)) return;
+    std::lock_guard<std::mutex> zone_alloc_lock(zone_alloc_mutex);
+    zones[group->iNum - ZONE_INUM(0)].live -= group->stored_length;
+}
+
+// a dead group got a reference again (only while replaying the journal), its bytes are live again
+inline void zone_retain(group_addr *group){
+    if (!IS_ZONE_INUM(group->iNum)) return;
+    std::lock_guard<std::mutex> zone_alloc_lock(zone_alloc_mutex);
+    zones[group->iNum - ZONE_INUM(0)].live += group->stored_length;
+}
+
+// reclaim the full zone with the least live bytes: move its live groups to the open zone and reset it.
+// return false if no zone has garbage. the caller must not hold zone_reclaim_mutex
+inline bool zone_reclaim(){
+    std::unique_lock<std::shared_mutex> unique_zone_reclaim_lock(zone_reclaim_mutex);
+    int victim = -1;
+    for (size_t z = 0; z < zones.size(); z++){
+        if (zones[z].cond != ZONE_FULL || zones[z].live == zones[z].wp) continue;
+        if (victim == -1 || zones[z].live < zones[victim].live) victim = z;
+    }
+    if (victim == -1) return false;
+    DEBUG_MESSAGE("reclaim zone " << victim << " live: " << zones[victim].live << " / " << zones[victim].wp);
+    std::vector<GROUP_ID_TYPE> victim_groups;
+    victim_groups.swap(zones[victim].groups);
+    char stored[COMPRESS_BOUND(MAX_GROUP_SIZE)];
+    zone_stripe stripe;     // live groups stay together in stripe units
+    for (size_t i = 0; i < victim_groups.size(); i++){
+        GROUP_ID_TYPE id = victim_groups[i];
+        group_addr *group = group_of(id);
+        if (group->iNum != ZONE_INUM(victim)) continue;     // left behind by a failed reclaim, lives elsewhere now
+        if (group_ref(id) == 0){    // dead, the index may still point to it but never returns it
+            zone_stats.freed += group->stored_length;
+            group->iNum = FREED_INUM;
+            group_bury(id);
+            continue;
+        }
+        bool moved = pread(zones[victim].fh, stored, group->stored_length, group->start_byte) == group->stored_length;
+        group_addr old_group = *group;
+        struct iovec iov = {stored, group->stored_length};
+        moved = moved && zone_reserve(&id, 1, true, &stripe) == 1;
+        moved = moved && zone_write_reserved(&id, &iov, 1);
+        if (!moved){    // keep the zone as it is, the groups not moved yet stay in it
+            PRINT_WARNING("zone reclaim failed!!");
+            *group = old_group;
+            zones[victim].groups.assign(victim_groups.begin() + i, victim_groups.end());
+            return false;
+        }
+        zone_stats.migrated += group->stored_length;
+        journal_log_move(id);
+    }
+    std::unique_lock<std::mutex> zone_alloc_lock(zone_alloc_mutex);
+    zones[victim].live = 0;     // everything live has moved, a failed commit below only delays the reset
+    zone_alloc_lock.unlock();
+    // the moves must be durable before the old copies are gone
+    journal_log_zone(victim, 0);
+    if (journal_enabled && journal_commit() != 0) return false;
+    zone_alloc_lock.lock();
+    if (ftruncate(zones[victim].fh, 0) == -1) PRINT_WARNING("zone reset failed!!");
+    journal_mark_data(zones[victim].fh);
+    zones[victim].cond = ZONE_EMPTY;
+    zones[victim].wp = 0;
+    zones[victim].live = 0;
+    zone_stats.resets++;
+    return true;
+}
+
+// append groups (their stored bytes in iov) of the stream of stripe into zones, reclaiming zones when no empty one
+// is left. reclaim_lock is held shared by the caller and released while reclaiming. return 0 or -errno
+inline int zone_write_groups(const GROUP_ID_TYPE *groups, struct iovec *iov, size_t num, zone_stripe *stripe, std::shared_lock<std::shared_mutex> &reclaim_lock){
+    for (size_t done = 0; done < num; ){
+        size_t reserved = zone_reserve(groups + done, num - done, false, stripe);
+        if (!zone_write_reserved(groups + done, iov + done, reserved)) return -EIO;
+        done += reserved;
+        if (done == num) break;
+        reclaim_lock.unlock();
+        bool reclaimed = zone_reclaim();
+        reclaim_lock.lock();
+        if (!reclaimed) return -ENOSPC;
+    }
+    return 0;
+}
+
+// rebuild zone state while replaying the journal: a group is stored in its zone
+inline void zone_recover_group(GROUP_ID_TYPE id){
+    group_addr *group = group_of(id);
+    zone_info *zone = &zones[group->iNum - ZONE_INUM(0)];
+    zone->groups.push_back(id);
+    zone->wp = std::max(zone->wp, (uint64_t)group->start_byte + group->stored_length);
+}
+
+// rebuild zone state while replaying the journal: the write pointer of a zone, 0 if it was reset
+inline void zone_recover_wp(uint32_t z, uint64_t wp){
+    if (z >= zones.size()) return;
+    if (wp == 0){
+        for (GROUP_ID_TYPE id : zones[z].groups){
+            if (group_of(id)->iNum != ZONE_INUM(z) || group_ref(id) > 0) continue;
+            group_of(id)->iNum = FREED_INUM;
+            group_bury(id);
+        }
+        zones[z].groups.clear();
+    }
+    zones[z].wp = wp == 0 ? 0 : std::max(wp, zones[z].wp);
+}
+
+// after replay every zone holding data is full and its live bytes are counted again, appends start in an empty zone
+inline void zone_recover_finish(){
+    for (size_t z = 0; z < zones.size(); z++){
+        zone_info *zone = &zones[z];
+        std::vector<GROUP_ID_TYPE> groups;
+        zone->live = 0;
+        for (GROUP_ID_TYPE id : zone->groups){
+            if (group_of(id)->iNum != ZONE_INUM(z)) continue;   // moved by reclaim
+            groups.push_back(id);
+            if (group_ref(id) > 0) zone->live += group_of(id)->stored_length;
+        }
+        zone->groups.swap(groups);
+        zone->cond = zone->wp > 0 ? ZONE_FULL : ZONE_EMPTY;
+    }
+    for (uint32_t d = 0; d < zone_device_num; d++) zone_devices[d].open_idx = -1;
+}
+
+// zones that are not empty, bytes written into them and live bytes in them
+inline void zone_usage(uint32_t *used_zones, uint64_t *written, uint64_t *live){
+    std::lock_guard<std::mutex> zone_alloc_lock(zone_alloc_mutex);
+    *used_zones = 0;
+    *written = *live = 0;
+    for (const zone_info &zone : zones){
+        if (zone.cond == ZONE_EMPTY) continue;
+        (*used_zones)++;
+        *written += zone.wp;
+        *live += zone.live;
+    }
+}
+
+#endif /* ZONE_H */
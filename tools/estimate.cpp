@@ -0,0 +1,321 @@
+// offline deduplication estimator: chunk and fingerprint a directory tree with several chunker/parameter
+// sets in one pass, to decide mi/av/ma before migrating a dataset onto CDCFS.
+// fingerprint records are spilled to one file per shard and counted shard by shard, so RAM doesn't grow with the
+// dataset, the disk holds 12 bytes per chunk per parameter set until the end.
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+#include "../src/def.h"
+#include "../src/chunker.h"
+
+#define ESTIMATE_PIECE_SIZE (64UL * 1024 * 1024)    // one work item, files are mmap'd piece by piece
+#define ESTIMATE_SHARD_BITS 10                      // fingerprint records are partitioned by their top bits
+#define ESTIMATE_SHARD_NUM (1 << ESTIMATE_SHARD_BITS)
+#define ESTIMATE_FLUSH_SIZE 65536                   // per thread records kept before moving them into the shards
+#define ESTIMATE_HIST_BUCKET 33                     // chunk size histogram, one bucket per power of two
+#define ESTIMATE_SPILL_RECORDS 512                  // records a shard keeps in RAM before appending them to its file
+#define ESTIMATE_SPILL_PATH "/tmp"                  // where the shard files go ("-d")
+
+// memory CDCFS spends on one unique chunk: fp_store node (key, value, next, cached hash), heap copy of the
+// SHA1 key, bucket pointer, and the group_addr and its reference count in the group table.
+#define FP_STORE_BYTES_PER_CHUNK (sizeof(FP_TYPE) + 3 * sizeof(void *) + 32 + sizeof(void *) + sizeof(group_addr) + sizeof(uint32_t))
+// memory of one chunk reference in the mapping table (group_pos + group_offset)
+#define MAPPING_BYTES_PER_CHUNK (sizeof(GROUP_ID_TYPE) + sizeof(off_t))
+
+struct __attribute__((packed)) fp_rec{
+    uint64_t fp;    // first 64 bits of SHA1, collisions are negligible for an estimation
+    uint32_t len;
+    bool operator<(const fp_rec &other) const { return fp < other.fp; }
+};
+
+struct param_set{
+    chunker engine;
+    std::string spill_path;     // shard i is spilled to spill_path + i
+    // results
+    std::vector<fp_rec> shard[ESTIMATE_SHARD_NUM];  // records not spilled yet
+    std::mutex shard_mutex[ESTIMATE_SHARD_NUM];
+    std::atomic<uint64_t> chunk_cnt{0};
+    std::atomic<uint64_t> hist[ESTIMATE_HIST_BUCKET] = {};
+    std::atomic<uint64_t> unique_cnt{0};
+    std::atomic<uint64_t> unique_bytes{0};
+};
+
+struct work_item{
+    size_t file_idx;
+    off_t offset;
+    size_t len;
+};
+
+static void estimate_piece(const chunker &engine, const uint8_t *data, size_t len, std::vector<fp_rec> &out, uint64_t *hist){
+    size_t offset = 0;
+    while (offset < len){
+        uint32_t cut_len = engine.cut(data + offset, std::min(len - offset, (size_t)UINT32_MAX), engine.param);
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1(data + offset, cut_len, digest);
+        fp_rec rec;
+        memcpy(&rec.fp, digest, sizeof(rec.fp));
+        rec.len = cut_len;
+        out.push_back(rec);
+        hist[63 - __builtin_clzll(cut_len)]++;
+        offset += cut_len;
+    }
+}
+
+static param_set *new_param_set(const char *name, uint32_t mi, uint32_t av, uint32_t ma){
+    param_set *param = new param_set;
+    if (chunker_init(&param->engine, name, mi, av, ma) == -1){
+        delete param;
+        return NULL;
+    }
+    return param;
+}
+
+std::atomic<bool> spill_failed{false};
+
+// append the buffered records of a shard to its file
+static void spill_shard(param_set &param, size_t shard_idx){
+    std::vector<fp_rec> &shard = param.shard[shard_idx];
+    if (shard.empty()) return;
+    std::string path = param.spill_path + std::to_string(shard_idx);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    ssize_t len = shard.size() * sizeof(fp_rec);
+    if (fd == -1 || write(fd, shard.data(), len) != len){
+        if (!spill_failed.exchange(true)) PRINT_WARNING("spill " << path << " failed: " << strerror(errno));
+    }
+    if (fd != -1) close(fd);
+    shard.clear();
+}
+
+// read back every record of a shard and remove its file
+static bool load_shard(param_set &param, size_t shard_idx, std::vector<fp_rec> &records){
+    std::string path = param.spill_path + std::to_string(shard_idx);
+    records.assign(param.shard[shard_idx].begin(), param.shard[shard_idx].end());
+    std::vector<fp_rec>().swap(param.shard[shard_idx]);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return errno == ENOENT;   // never spilled
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    size_t buffered = records.size();
+    if (ok){
+        records.resize(buffered + st.st_size / sizeof(fp_rec));
+        ok = read(fd, records.data() + buffered, st.st_size) == st.st_size;
+    }
+    close(fd);
+    unlink(path.c_str());
+    return ok;
+}
+
+static void flush_records(param_set &param, std::vector<fp_rec> &local){
+    // group by shard first so every shard lock is taken once per flush
+    std::sort(local.begin(), local.end(), [](const fp_rec &a, const fp_rec &b) {
+        return (a.fp >> (64 - ESTIMATE_SHARD_BITS)) < (b.fp >> (64 - ESTIMATE_SHARD_BITS));
+    });
+    size_t i = 0;
+    while (i < local.size()){
+        size_t shard_idx = local[i].fp >> (64 - ESTIMATE_SHARD_BITS), j = i;
+        while (j < local.size() && (local[j].fp >> (64 - ESTIMATE_SHARD_BITS)) == shard_idx) j++;
+        std::lock_guard<std::mutex> shard_lock(param.shard_mutex[shard_idx]);
+        param.shard[shard_idx].insert(param.shard[shard_idx].end(), local.begin() + i, local.begin() + j);
+        if (param.shard[shard_idx].size() >= ESTIMATE_SPILL_RECORDS) spill_shard(param, shard_idx);
+        i = j;
+    }
+    local.clear();
+}
+
+// RAM of a run: the records buffered by every thread and every shard, then the shards counted at once. chunks are
+// assumed to be av bytes on average, which overestimates for chunkers cutting past mi first
+static uint64_t projected_memory(const std::vector<std::unique_ptr<param_set>> &params, uint64_t total_bytes, unsigned thread_num){
+    uint64_t largest_shard = 0;
+    for (const auto &param : params){
+        uint64_t chunks = total_bytes / std::max(param->engine.param.av, 1U) + 1;
+        largest_shard = std::max(largest_shard, chunks / ESTIMATE_SHARD_NUM + ESTIMATE_SPILL_RECORDS);
+    }
+    uint64_t buffers = params.size() * ESTIMATE_SHARD_NUM * ESTIMATE_SPILL_RECORDS;
+    uint64_t scanning = thread_num * params.size() * (uint64_t)ESTIMATE_FLUSH_SIZE, counting = thread_num * largest_shard;
+    return (buffers + std::max(scanning, counting)) * sizeof(fp_rec);
+}
+
+static void usage(const char *prog){
+    std::cerr << "usage: " << prog << " [-j threads] [-m memory_limit_MB] [-d spill_dir] [-p [chunker:]mi:av:ma]... <dir>" << std::endl
+              << "  default parameter sets: " DEFAULT_CHUNKER ":0:" << BLOCK_SIZE << ":" << MAX_GROUP_SIZE
+              << " 1024:2048:16384 4096:8192:65536 8192:16384:131072" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned thread_num = std::thread::hardware_concurrency();
+    uint64_t memory_limit = 0;      // MB, 0: no limit
+    std::string spill_dir = ESTIMATE_SPILL_PATH;
+    std::vector<std::unique_ptr<param_set>> params;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:m:d:p:")) != -1){
+        switch (opt){
+            case 'j': thread_num = atoi(optarg); break;
+            case 'm': memory_limit = strtoull(optarg, NULL, 10); break;
+            case 'd': spill_dir = optarg; break;
+            case 'p': {
+                char name[32] = DEFAULT_CHUNKER;
+                uint32_t mi, av, ma;
+                param_set *param = NULL;
+                if (sscanf(optarg, "%u:%u:%u", &mi, &av, &ma) == 3 || sscanf(optarg, "%31[^:]:%u:%u:%u", name, &mi, &av, &ma) == 4){
+                    param = new_param_set(name, mi, av, ma);
+                }
+                if (param == NULL){
+                    usage(argv[0]);
+                    return 1;
+                }
+                params.emplace_back(param);
+                break;
+            }
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc){
+        usage(argv[0]);
+        return 1;
+    }
+    if (params.empty()){
+        const uint32_t defaults[][3] = {{0, BLOCK_SIZE, MAX_GROUP_SIZE}, {1024, 2048, 16384}, {4096, 8192, 65536}, {8192, 16384, 131072}};
+        for (auto &d : defaults) params.emplace_back(new_param_set(DEFAULT_CHUNKER, d[0], d[1], d[2]));
+    }
+    if (thread_num == 0) thread_num = 1;
+
+    // walk the tree and cut every file into pieces
+    std::vector<std::string> files;
+    std::vector<work_item> items;
+    uint64_t total_bytes = 0;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(argv[optind], std::filesystem::directory_options::skip_permission_denied, ec);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(ec)){
+        if (ec) break;
+        if (!it->is_regular_file(ec) || it->is_symlink(ec)) continue;
+        size_t size = it->file_size(ec);
+        if (ec || size == 0) continue;
+        for (off_t off = 0; off < (off_t)size; off += ESTIMATE_PIECE_SIZE){
+            items.push_back({files.size(), off, std::min(ESTIMATE_PIECE_SIZE, size - off)});
+        }
+        files.push_back(it->path().string());
+        total_bytes += size;
+    }
+    PRINT_MESSAGE("scanning " << files.size() << " files, " << (double)total_bytes / 1000000000 << "GB with " << thread_num << " threads");
+    uint64_t memory = projected_memory(params, total_bytes, thread_num), spill = 0;
+    for (const auto &param : params) spill += total_bytes / std::max(param->engine.param.av, 1U) * sizeof(fp_rec);
+    PRINT_MESSAGE("projected memory: " << (double)memory / 1000000 << "MB, spill: " << (double)spill / 1000000000 << "GB in " << spill_dir);
+    if (memory_limit > 0 && memory > memory_limit * 1000000){
+        PRINT_WARNING("projected memory exceeds " << memory_limit << "MB, use fewer threads (-j) or parameter sets (-p)");
+        return 1;
+    }
+    std::string spill_root = spill_dir + "/cdcfs_estimate.XXXXXX";
+    if (mkdtemp(spill_root.data()) == NULL){
+        PRINT_WARNING("can't create a spill directory in " << spill_dir << ": " << strerror(errno));
+        return 1;
+    }
+    for (size_t param_idx = 0; param_idx < params.size(); param_idx++){
+        params[param_idx]->spill_path = spill_root + "/" + std::to_string(param_idx) + "_";
+    }
+
+    // chunk and fingerprint, the mapped piece is chunked by every parameter set while it is hot in cache
+    std::atomic<size_t> next_item{0};
+    auto scan = [&]() {
+        std::vector<std::vector<fp_rec>> local(params.size());
+        std::vector<std::vector<uint64_t>> local_hist(params.size(), std::vector<uint64_t>(ESTIMATE_HIST_BUCKET));
+        size_t item_idx;
+        while ((item_idx = next_item++) < items.size()){
+            work_item &item = items[item_idx];
+            int fd = open(files[item.file_idx].c_str(), O_RDONLY);
+            if (fd == -1){
+                PRINT_WARNING("open " << files[item.file_idx] << " failed: " << strerror(errno));
+                continue;
+            }
+            void *data = mmap(NULL, item.len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, item.offset);
+            close(fd);
+            if (data == MAP_FAILED){
+                PRINT_WARNING("mmap " << files[item.file_idx] << " failed: " << strerror(errno));
+                continue;
+            }
+            madvise(data, item.len, MADV_SEQUENTIAL);
+            for (size_t param_idx = 0; param_idx < params.size(); param_idx++){
+                param_set &param = *params[param_idx];
+                // a piece boundary forces a cut, one extra chunk per ESTIMATE_PIECE_SIZE is negligible
+                estimate_piece(param.engine, (const uint8_t *)data, item.len, local[param_idx], local_hist[param_idx].data());
+                if (local[param_idx].size() >= ESTIMATE_FLUSH_SIZE) flush_records(param, local[param_idx]);
+            }
+            munmap(data, item.len);
+        }
+        for (size_t param_idx = 0; param_idx < params.size(); param_idx++){
+            flush_records(*params[param_idx], local[param_idx]);
+            for (int b = 0; b < ESTIMATE_HIST_BUCKET; b++) params[param_idx]->hist[b] += local_hist[param_idx][b];
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < thread_num; t++) workers.emplace_back(scan);
+    for (auto &worker : workers) worker.join();
+    workers.clear();
+
+    // count unique fingerprints shard by shard, a shard is read back from its file
+    std::atomic<size_t> next_shard{0};
+    auto count = [&]() {
+        size_t job;
+        std::vector<fp_rec> shard;
+        while ((job = next_shard++) < params.size() * ESTIMATE_SHARD_NUM){
+            param_set &param = *params[job / ESTIMATE_SHARD_NUM];
+            if (!load_shard(param, job % ESTIMATE_SHARD_NUM, shard) && !spill_failed.exchange(true)){
+                PRINT_WARNING("read back shard " << job % ESTIMATE_SHARD_NUM << " failed");
+            }
+            std::sort(shard.begin(), shard.end());
+            uint64_t unique_cnt = 0, unique_bytes = 0;
+            for (size_t i = 0; i < shard.size(); i++){
+                if (i == 0 || shard[i].fp != shard[i - 1].fp){
+                    unique_cnt++;
+                    unique_bytes += shard[i].len;
+                }
+            }
+            param.chunk_cnt += shard.size();
+            param.unique_cnt += unique_cnt;
+            param.unique_bytes += unique_bytes;
+            shard.clear();
+        }
+    };
+    for (unsigned t = 0; t < thread_num; t++) workers.emplace_back(count);
+    for (auto &worker : workers) worker.join();
+    std::filesystem::remove_all(spill_root, ec);
+    if (spill_failed){
+        PRINT_WARNING("spilling fingerprint records failed, no result");
+        return 1;
+    }
+
+    // report
+    for (auto &param_ptr : params){
+        param_set &param = *param_ptr;
+        PRINT_MESSAGE("---------------- " << param.engine.name << " mi:" << param.engine.param.mi << " av:" << param.engine.param.av
+                      << " ma:" << param.engine.param.ma << " ----------------");
+        PRINT_MESSAGE("  chunks: " << param.chunk_cnt << " unique: " << param.unique_cnt
+                      << " avg chunk: " << (param.chunk_cnt ? total_bytes / param.chunk_cnt : 0) << "B");
+        PRINT_MESSAGE("  dedup rate: " << std::fixed << std::setprecision(2)
+                      << (total_bytes ? (1 - (double)param.unique_bytes / total_bytes) * 100 : 0) << "%"
+                      << " (unique data " << (double)param.unique_bytes / 1000000000 << "GB)");
+        PRINT_MESSAGE("  projected index memory: fp_store " << (double)param.unique_cnt * FP_STORE_BYTES_PER_CHUNK / 1000000 << "MB"
+                      << ", mapping table " << (double)param.chunk_cnt * MAPPING_BYTES_PER_CHUNK / 1000000 << "MB");
+        PRINT_MESSAGE("  chunk size histogram:");
+        for (int b = 0; b < ESTIMATE_HIST_BUCKET; b++){
+            if (param.hist[b] == 0) continue;
+            PRINT_MESSAGE("    [" << (1UL << b) << ", " << (2UL << b) << "): " << param.hist[b]
+                          << " (" << (double)param.hist[b] / param.chunk_cnt * 100 << "%)");
+        }
+        std::cout.unsetf(std::ios::fixed);
+    }
+    return 0;
+}